@@ -43,16 +43,77 @@
 //!	@{
 //!		@defgroup	hierclust	Hierarchical Clustering
 //!		@brief		Produce nested sets of clusters
+//!		@defgroup	partclust	Partitional Clustering
+//!		@brief		Partition observations into a given number of clusters
+//!		@defgroup	clusteval	Cluster Evaluation
+//!		@brief		Assess the quality of clusters
 //!	@}
 
 #pragma once
 
 #include <armadillo>
+#include <fstream>
+
+#ifdef ARMA_EXT_USE_CPP11
+#include <atomic>
+#endif
+
+#ifdef USE_PPL
+#include <ppl.h>
+
+#if	(_MSC_VER <= 1600)
+/// From Microsoft Visual Studio 2012, Concurrency namespace has been changed to concurrency.
+/// For compatibility, namespace alias is used
+namespace concurrency = Concurrency;
+#endif
+#endif
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>	// __popcnt64
+#endif
 
 #ifndef ARMA_EXT_USE_CPP11
 #define nullptr	NULL
 #endif
 
+#ifdef _MSC_VER
+#define ARMA_EXT_PRAGMA(x)	__pragma(x)
+#else
+#define ARMA_EXT_PRAGMA(x)	_Pragma(#x)
+#endif
+
+/*
+ *	ARMA_EXT_PARALLEL_FOR(i, n) ... ARMA_EXT_PARALLEL_END runs the body for i = 0, ..., n - 1 in parallel,
+ *	with PPL or OpenMP, or serially. ARMA_EXT_PARALLEL_FOR_DYNAMIC(i, n, chunk) hands the iterations out
+ *	in chunks as the threads become idle, for bodies of uneven cost. The body is a lambda with PPL,
+ *	so it must not break, continue or return out of the loop.
+ */
+#if defined(USE_PPL)
+#define ARMA_EXT_PARALLEL_FOR(i, n)					concurrency::parallel_for(uword(0), uword(n), [&](uword i) {
+#define ARMA_EXT_PARALLEL_FOR_DYNAMIC(i, n, chunk)	ARMA_EXT_PARALLEL_FOR(i, n)
+#define ARMA_EXT_PARALLEL_END						});
+#elif defined(USE_OPENMP)
+#define ARMA_EXT_PARALLEL_FOR(i, n)					ARMA_EXT_PRAGMA(omp parallel for) for (int i##_s = 0 ; i##_s < (int)(n) ; i##_s++) { uword i = (uword)i##_s;
+#define ARMA_EXT_PARALLEL_FOR_DYNAMIC(i, n, chunk)	ARMA_EXT_PRAGMA(omp parallel for schedule(dynamic, chunk)) for (int i##_s = 0 ; i##_s < (int)(n) ; i##_s++) { uword i = (uword)i##_s;
+#define ARMA_EXT_PARALLEL_END						}
+#else
+#define ARMA_EXT_PARALLEL_FOR(i, n)					for (uword i = 0 ; i < uword(n) ; i++) {
+#define ARMA_EXT_PARALLEL_FOR_DYNAMIC(i, n, chunk)	ARMA_EXT_PARALLEL_FOR(i, n)
+#define ARMA_EXT_PARALLEL_END						}
+#endif
+
 namespace arma_ext
 {
 	using namespace arma;
@@ -80,352 +141,2660 @@ namespace arma_ext
 		spearman,		///< One minus the sample Spearman's rank correlation betweenobservations (treated as sequences of values).
 		hamming,		///< Hamming distance, which is the percentage of coordinatesthat differ.
 		jaccard,		///< One minus the Jaccard coefficient, which is the percentageof nonzero coordinates that differ.
-		custom
+		squaredeuclidean,		///< Squared Euclidean distance.
+		fasteuclidean,			///< Euclidean distance computed from inner products with BLAS. Faster for wide data, but less accurate for nearby observations.
+		fastsquaredeuclidean,	///< Squared Euclidean distance computed from inner products with BLAS.
+		custom					///< Distance function given by the caller.
 	};
 
-#ifndef DOXYGEN
-	typedef double (*pdist_func)(const arma::subview_row<double>&, const arma::subview_row<double>&);
-
-	/// Euclidean distance for pdist
-	double pdist_euclidean(const arma::subview_row<double>& a, const arma::subview_row<double>& b)
-	{
-		return sqrt(sum(square(b - a)));
-	}
+	/**
+	 *	@brief	Algorithm for computing the distance between clusters.<br>
+	 *			The centroid, median and ward methods are appropriate for Euclidean distances only.
+	 */
+#ifdef ARMA_EXT_USE_CPP11
+	enum linkage_method : uword
+#else
+	enum linkage_method
 #endif
+	{
+		single_linkage,		///< Shortest distance.
+		complete_linkage,	///< Furthest distance.
+		average_linkage,	///< Unweighted average distance (UPGMA).
+		weighted_linkage,	///< Weighted average distance (WPGMA).
+		centroid_linkage,	///< Centroid distance (UPGMC).
+		median_linkage,		///< Weighted center of mass distance (WPGMC).
+		ward_linkage		///< Inner squared distance (minimum variance algorithm).
+	};
 
 	/**
-	 *	@brief	Pairwise distance between pairs of objects.<br>
-	 *			Computes the distance between pairs of objects in \f$m\f$-by-\f$n\f$ data matrix \f$X\f$.<br>
-	 *			Rows of \f$X\f$ correspond to observations, and columns correspond to variables.
-	 *			Output is the row vector of length \f$ \frac{m(m - 1)}{2} \f$, corresponding to pairs of observations in \f$X\f$.<br>
-	 *			The distances are arranged in the order \f$(2, 1), (3, 1), \cdots, (m, 1), (3, 2), \cdots, (m, 2), \cdots, (m, m - 1)\f$.<br>
-	 *			Output is commonly used as a dissimilarity matrix in clustering or multidimensional scailing.
-	 *	@return	Pairwise distance.
-	 *	@note	This is preliminary implementation.
+	 *	@brief	Condensed distance vector stored in a memory-mapped file.<br>
+	 *			It is a light weight handle; copies share the mapping, which is released with the last copy.
+	 *			The distances are arranged in the same order as the output of #pdist.
+	 *	@see	pdist_mapped
 	 */
-	vec pdist(const mat& X, distance_type type = euclidean, pdist_func func_ptr = nullptr)
+	class mapped_distance
 	{
-		const uword m = X.n_rows;
-		vec Y(m * (m - 1) / 2);
-		double* ptr = Y.memptr();
-
-		switch (type) {
-		case euclidean:
-			func_ptr = pdist_euclidean;
-			break;
-		case custom:
-			// stub
-			break;
-		default:
-			func_ptr = &pdist_euclidean;
-		}
-
-		uword k = 0;
-		for (uword i = 0 ; i < m ; i++)
-			for (uword j = i + 1 ; j < m ; j++)
-				ptr[k++] = func_ptr(X.row(i), X.row(j)); //sqrt(sum(square(X.row(j) - X.row(i))));
+	public:
+		typedef double elem_type;
 
-		return Y;
-	}
+		/**
+		 *	@brief	Maps the condensed distances of \f$m\f$ observations.
+		 *	@param filename	The file of the distances.
+		 *	@param m		The number of observations.
+		 *	@param create	Creates (or truncates) the file if true, otherwise opens the existing file.
+		 */
+		mapped_distance(const std::string& filename, const uword m, const bool create = false)
+			: state(new mapping())
+		{
+			state->n_obs = m;
+			state->n_elem = m * (m - 1) / 2;
+			state->mem = nullptr;
 
-#ifndef DOXYGEN
-	//!	Cut the tree at a specified point.
-	uvec checkcut(const mat& X, double cutoff, const vec& crit)
-	{
-		// See which nodes are below the cutoff, disconnect thoese that aren't
-		uword n = X.n_rows + 1;
-		uvec conn = (crit <= cutoff); // these are still connected
-		
-		// We may still disconnect a node unless all non-leaf children are
-		// below the cutoff, and grand-children, and so on
-		uvec todo = conn % ((X.col(0) > n) + (X.col(1) > n));
-
-		while (any(todo)) {
-			uvec rows = find(todo);
-
-			// See if each child is done, or if it requires disconnecting its parent
-			umat cdone = ones<umat>(rows.n_elem, 2);
-
-			for (uword j = 0 ; j < 2 ; j++) { // 0: left child, 1: right child
-				vec crows = vec(X.col(j)).elem(rows);
-				uvec t = (crows > n);
-				if (any(t)) {
-					uvec ti = find(t);
-
-					uvec child = conv_to<uvec>::from(crows(ti) - n);
-					
-					// cdone(t,j) = ~todo(child);
-					// conn(rows(t)) = conn(rows(t)) & conn(child);
-					for (uword k = 0 ; k < ti.n_elem ; k++) {
-						uword tval = ti[k];
-						uword childval = child[k] - 1;	// 0-based indexing
-						cdone.at(tval, j) = logical_not(todo[childval]);
-						conn[rows[tval]] = conn(rows[tval]) & conn[childval];
-					}
-				}
+			if (!open(filename, create)) {
+				delete state;
+				throw std::runtime_error("Failed to map the distance file " + filename + ".");
 			}
-
-			// update todo list
-			todo(rows(find(cdone.col(0) % cdone.col(1)))).fill(0);
 		}
 
-		return conn;
-	}
+		mapped_distance(const mapped_distance& other)
+			: state(other.state)
+		{
+			state->count++;
+		}
 
-	//!	Assign cluster number
-	uvec labeltree(const mat& X, uvec conn)
-	{
-		uword n = X.n_rows;
-		uword nleaves = n + 1;
-		uvec T = ones<uvec>(n + 1);
+		mapped_distance& operator=(const mapped_distance& other)
+		{
+			if (state != other.state) {
+				release();
+				state = other.state;
+				state->count++;
+			}
+			return *this;
+		}
 
-		// Each cut potentially yeild as additional cluster
-		uvec todo = ones<uvec>(n);
+		~mapped_distance()
+		{
+			release();
+		}
 
-		// Define cluster numbers for each side of each non-leaf node
-		umat clustlist = reshape(arma_ext::colon<uvec>(1, 2 * n), n, 2);
+		//!	The number of observations.
+		uword n_obs() const		{ return state->n_obs; }
+		//!	The number of pairwise distances.
+		uword size() const		{ return state->n_elem; }
 
-		// Propagate cluster numbers down the tree
-		while (any(todo)) {
-			// Work on rows that are now split but not yet processed
-			// rows = find(todo & ~conn);
-			uvec rows = find(todo % logical_not(conn));
-			if (rows.empty()) break;
+		double* memptr()				{ return state->mem; }
+		const double* memptr() const	{ return state->mem; }
 
-			for (uword j = 0 ; j < 2 ; j++) {	// 0: left, 1: right
-				uvec children = conv_to<uvec>::from(X.col(j)).elem(rows);
+		/**
+		 *	@brief	Writes the distances in [begin, end) back to the file and releases their pages.
+		 */
+		void flush(const uword begin, const uword end)
+		{
+			if (begin >= end) return;
 
-				// Assign cluster number to child leaf node
-				uvec leaf = (children <= nleaves);
-				if (any(leaf)) {
-					uvec leafi = find(leaf);
-#ifdef ARMA_EXT_USE_CPP11
-					std::for_each(leafi.begin(), leafi.end(), [&](uword index) {
+#ifdef _WIN32
+			FlushViewOfFile(state->mem + begin, (end - begin) * sizeof(double));
 #else
-					for (size_type i = 0 ; i < leafi.size() ; i++) {
-						uword index = leafi[i];
+			// msync and madvise require page aligned addresses
+			const std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+			char* first = (char*)(((std::size_t)(state->mem + begin)) & ~(page - 1));
+			char* last = (char*)(state->mem + end);
+			msync(first, last - first, MS_SYNC);
+			madvise(first, last - first, MADV_DONTNEED);
 #endif
-						T[children[index] - 1] = clustlist.at(rows[index], j);
-#ifdef ARMA_EXT_USE_CPP11
-					});
-#else
-					}
-#endif
-				}
+		}
 
-				// Also assign it to both children of any joined child non-leaf nodes
-				uvec joint = logical_not(leaf);	// ~leaf
-				uvec jointi = find(joint);
-				joint(jointi) = conn(children(jointi) - nleaves - 1);
+	private:
+		struct mapping
+		{
+			mapping() : count(1) {}
 
-				if (any(joint)) {
-#ifdef ARMA_EXT_USE_CPP11
-					std::for_each(jointi.begin(), jointi.end(), [&](uword index) {
+			uword count;
+			uword n_obs;
+			uword n_elem;
+			double* mem;
+#ifdef _WIN32
+			HANDLE file;
+			HANDLE map;
 #else
-					for (size_type i = 0 ; i < jointi.size() ; i++) {
-						uword index = jointi[i];
+			int fd;
 #endif
-						uword clustnum = clustlist(rows(index), j);
-						uword childnum = children(index) - nleaves - 1;
-						clustlist.row(childnum).fill(clustnum);
-						conn(childnum) = 0;
-#ifdef ARMA_EXT_USE_CPP11
-					});
+		};
+
+		mapping* state;
+
+		bool open(const std::string& filename, const bool create)
+		{
+			const uword bytes = state->n_elem * sizeof(double);
+
+#ifdef _WIN32
+			state->file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+				create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (state->file == INVALID_HANDLE_VALUE) return false;
+
+			LARGE_INTEGER size;
+			if (!create && (!GetFileSizeEx(state->file, &size) || (uword)size.QuadPart != bytes)) {
+				CloseHandle(state->file);
+				return false;
+			}
+
+			state->map = NULL;
+			if (bytes == 0) return true;
+
+			state->map = CreateFileMappingA(state->file, NULL, PAGE_READWRITE,
+				(DWORD)((unsigned long long)bytes >> 32), (DWORD)(bytes & 0xFFFFFFFF), NULL);
+			if (state->map != NULL)
+				state->mem = (double*)MapViewOfFile(state->map, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+
+			if (state->mem == nullptr) {
+				if (state->map != NULL) CloseHandle(state->map);
+				CloseHandle(state->file);
+				return false;
+			}
 #else
-					}
-#endif
-				}
+			state->fd = ::open(filename.c_str(), create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+			if (state->fd < 0) return false;
+
+			struct stat st;
+			const bool sized = create ? (ftruncate(state->fd, (off_t)bytes) == 0)
+				: (fstat(state->fd, &st) == 0 && (uword)st.st_size == bytes);
+			if (!sized) {
+				::close(state->fd);
+				return false;
 			}
 
-			// Mark these rows as done
-			todo(rows).fill(0);
+			if (bytes == 0) return true;
+
+			void* addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, 0);
+			if (addr == MAP_FAILED) {
+				::close(state->fd);
+				return false;
+			}
+			state->mem = (double*)addr;
+#endif
+			return true;
 		}
 
-		uvec U = unique(T);
-		// re-assign
-		for (uword i = 0; i < U.n_elem; i++)
-			T.elem(find(T == U.at(i))).fill(i + 1);
-		return T;
-	}
+		void release()
+		{
+			if (--state->count > 0) return;
+
+#ifdef _WIN32
+			if (state->mem != nullptr) UnmapViewOfFile(state->mem);
+			if (state->map != NULL) CloseHandle(state->map);
+			CloseHandle(state->file);
+#else
+			if (state->mem != nullptr) munmap(state->mem, state->n_elem * sizeof(double));
+			::close(state->fd);
+#endif
+			delete state;
+		}
+	};
 
 	/**
-	 *	@note	This function taken from linkagemex.cpp, and partially adopted.
-	 *			This function could have copyright problem.
-	 *	@copyright 2003-2006 The MathWorks, Inc.
+	 *	@brief	Condensed distance matrix of \f$m\f$ observations.<br>
+	 *			A view of existing memory (a vector, a memory-mapped file or a buffer of any element type)
+	 *			holding the distances in the order \f$(2, 1), (3, 1), \cdots, (m, 1), (3, 2), \cdots, (m, m - 1)\f$.
+	 *			The view does not copy nor own the memory, and the \f$m\f$-by-\f$m\f$ square matrix is only
+	 *			formed on demand.
 	 */
-	template <typename mat_type>
-	mat linkagemex(const mat_type& X)
+	template <typename eT>
+	class condensed_distance
 	{
-		#define ISNAN_(a) (a != a)
+	public:
+		typedef eT elem_type;
 
-		enum method_types {single, complete, average, weighted, centroid, median, ward} method_key;
+		/// Wraps a buffer of the distances of m observations.
+		condensed_distance(eT* mem_, const uword m)
+			: mem(mem_), m_obs(m), n(m * (m - 1) / 2)
+		{
+		}
 
-		typedef int mwSize;
-		typedef double TEMPL;
+		/// Wraps a condensed distance vector, such as the output of #pdist.
+		condensed_distance(const Mat<eT>& Y)
+			: mem(const_cast<eT*>(Y.memptr())), m_obs(observations(Y.n_elem)), n(Y.n_elem)
+		{
+		}
 
-		static TEMPL  inf;
-		mwSize        m,m2,m2m3,m2m1,n,i,j,bn,bc,bp,p1,p2,q,q1,q2,h,k,l,g;
-		mwSize        nk,nl,ng,nkpnl,sT,N;
-		mwSize        *obp,*scl,*K,*L;
-		TEMPL         *y,*yi,*s,*b1,*b2,*T;
-		TEMPL         t1,t2,t3,rnk,rnl;
-		int           uses_scl = false,  no_squared_input = true;
+		/// Wraps a memory-mapped condensed distance vector.
+		condensed_distance(mapped_distance& Y)
+			: mem(Y.memptr()), m_obs(Y.n_obs()), n(Y.size())
+		{
+		}
 
-		/* get the method */
-		method_key = single;
+		//!	The number of observations.
+		uword n_obs() const		{ return m_obs; }
+		//!	The number of pairwise distances.
+		uword size() const		{ return n; }
 
-		/* get the dimensions of inputs */
-		n = (mwSize)X.size();	/* number of pairwise distances --> n */
-		m = (mwSize)std::ceil(std::sqrt(2.0 * n));	/* size of distance matrix --> m = (1 + sqrt(1+8*n))/2 */
+		eT* memptr()				{ return mem; }
+		const eT* memptr() const	{ return mem; }
 
-		/*  create a pointer to the input pairwise distances */
-		yi = const_cast<double*>(X.memptr());
+		//!	Offset of the distance between the observations i and j, i < j.
+		uword offset(const uword i, const uword j) const
+		{
+			return i * (2 * m_obs - i - 1) / 2 + (j - i - 1);
+		}
 
-		/* set space to copy the input */
-		y = (TEMPL *) malloc(n * sizeof(TEMPL));
+		//!	Distance between the observations i and j.
+		eT operator()(const uword i, const uword j) const
+		{
+			return (i == j) ? eT(0) : (i < j ? mem[offset(i, j)] : mem[offset(j, i)]);
+		}
 
-		/* copy input and compute Y^2 if necessary.  lots of books use 0.5*Y^2
-		* for ward's, but the 1/2 makes no difference */
-		if (no_squared_input) memcpy(y,yi,n * sizeof(TEMPL));
-		else /* then it is ward's, centroid, or median */
-			for (i=0; i<n; i++) y[i] = yi[i] * yi[i];
+		/**
+		 *	@brief	Copies the distances from the observation i to every observation into dst.
+		 *	@param i	The observation.
+		 *	@param dst	The buffer of \f$m\f$ elements.
+		 */
+		void row(const uword i, eT* dst) const
+		{
+			uword k = i - 1;	// offset(0, i)
+			for (uword j = 0 ; j < i ; j++) {
+				dst[j] = mem[k];
+				k += m_obs - j - 2;
+			}
+			dst[i] = eT(0);
 
-		/* calculate some other constants */
-		bn   = m-1;                        /* number of branches     --> bn */
-		m2   = m * 2;                      /* 2*m */
-		m2m3 = m2 - 3;                     /* 2*m - 3 */
-		m2m1 = m2 - 1;                     /* 2*m - 1 */
+			if (i + 1 < m_obs) {
+				const eT* src = mem + offset(i, i + 1);
+				std::copy(src, src + (m_obs - i - 1), dst + i + 1);
+			}
+		}
 
-		inf = arma::datum::inf;
+		//!	Distances from the observation i to every observation.
+		Row<eT> row(const uword i) const
+		{
+			Row<eT> out(m_obs);
+			row(i, out.memptr());
+			return out;
+		}
 
-		/*  allocate space for the output matrix  */
-		mat out(bn, 3);
-		b1 = out.memptr();	/*leftmost  column */
-		b2 = b1 + bn;		/*center    column */
-		s = b2 + bn;		/*rightmost column */
+		//!	The \f$m\f$-by-\f$m\f$ square distance matrix.
+		Mat<eT> squareform() const
+		{
+			Mat<eT> out(m_obs, m_obs);
+			for (uword i = 0 ; i < m_obs ; i++)
+				row(i, out.colptr(i));	// symmetric
+			return out;
+		}
 
-		/* find the best value for N (size of the temporal vector of  */
-		/* minimums) depending on the problem size */
-		if      (m>1023) N = 512;
-		else if (m>511)  N = 256;
-		else if (m>255)  N = 128;
-		else if (m>127)  N = 64;
-		else if (m>63)   N = 32;
-		else             N = 16;
+		//!	The number of observations of a condensed distance vector of n elements.
+		static uword observations(const uword n)
+		{
+			const uword m = (uword)((1 + std::sqrt(1 + 8.0 * n)) / 2 + 0.5);
+			if (m * (m - 1) / 2 != n && !(n == 0 && m == 1))
+				throw std::invalid_argument("The number of elements is not a number of pairwise distances.");
+			return m;
+		}
 
-		if (method_key == single) N = N >> 2;
+	private:
+		eT* mem;
+		uword m_obs;
+		uword n;
+	};
 
-		/* set space for the vector of minimums (and indexes) */
-		T = (TEMPL *)malloc(N * sizeof(TEMPL));
-		K = (mwSize *)malloc(N * sizeof(mwSize));
-		L = (mwSize *)malloc(N * sizeof(mwSize));
+	/**
+	 *	@brief	Converts a condensed distance vector to the square distance matrix.
+	 *	@param y	The condensed distance vector, as generated by #pdist function.
+	 *	@return	The \f$m\f$-by-\f$m\f$ symmetric distance matrix with zero diagonal.
+	 *	@see	http://www.mathworks.com/help/stats/squareform.html
+	 */
+	template <typename eT>
+	inline Mat<eT> squareform(const Col<eT>& y)
+	{
+		return condensed_distance<eT>(y).squareform();
+	}
 
-		/* set space for the obs-branch pointers  */
-		obp = (mwSize *) malloc(m * sizeof(mwSize));
+	/**
+	 *	@brief	Converts a square distance matrix to the condensed distance vector.
+	 *	@param Z	The \f$m\f$-by-\f$m\f$ symmetric distance matrix.
+	 *	@return	The condensed distance vector of the lower triangle of @c Z.
+	 */
+	template <typename eT>
+	inline Col<eT> squareform(const Mat<eT>& Z)
+	{
+		if (Z.n_rows != Z.n_cols)
+			throw std::invalid_argument("The distance matrix must be square.");
 
-		switch (method_key) {
-		case average:
-		case centroid:
-		case ward:
-			uses_scl = true;
-			/* set space for the size of clusters vector */
-			scl = (mwSize *) malloc(m * sizeof(mwSize));
-			/* initialize obp and scl */
-			for (i=0; i<m; obp[i]=i, scl[i++]=1);
-			break;
-		default: /*all other cases */
-			/* only initialize obp */
-			for (i=0; i<m; i++) obp[i]=i;
-		} /* switch (method_key) */
+		const uword m = Z.n_rows;
+		Col<eT> y(m * (m - 1) / 2);
+		eT* dst = y.memptr();
+		for (uword j = 0 ; j < m ; j++)
+			for (uword i = j + 1 ; i < m ; i++)
+				*dst++ = Z.at(i, j);
+		return y;
+	}
 
-		sT = 0;  t3 = inf;
+#ifndef DOXYGEN
+	typedef double (*pdist_func)(const arma::subview_row<double>&, const arma::subview_row<double>&);
 
-		for (bc=0,bp=m;bc<bn;bc++,bp++){
-			/* *** MAIN LOOP ***
-			bc is a "branch counter" --> bc = [ 0:bn-1]
-			bp is a "branch pointer" --> bp = [ m:m+bc-1 ], it is used to point
-			branches in the output since the values [0:m-1]+1 are reserved for
-			leaves.
-			*/
+	/// Euclidean distance for pdist
+	inline double pdist_euclidean(const arma::subview_row<double>& a, const arma::subview_row<double>& b)
+	{
+		return sqrt(sum(square(b - a)));
+	}
 
-			/*
-			find the "k","l" indices of the minimum distance "t1" in the remaining
-			half matrix, the new computed distances to the new cluster will be placed
-			in the row/col "l", then the leftmost column in the matrix of pairwise
-			distances will be moved to the row/col "k", so the whole matrix of
-			distances is smaller at every step */
+	/// Number of observations per tile; two tiles of packed observations are kept within the L2 cache.
+	inline uword pdist_block_size(const uword n)
+	{
+		const uword bs = 16384 / std::max<uword>(n, 1);
+		return std::min<uword>(std::max<uword>(bs, 8), 256);
+	}
 
-			/*  OLD METHOD: search for the minimun in the whole "y" at every branch
-			iteration
-			t1 = inf;
-			p1 = ((m2m1 - bc) * bc) >> 1; // finds where the remaining matrix starts
-			for (j=bc; j<m; j++) {
-			for (i=j+1; i<m; i++) {
-			t2 = y[p1++];
-			if (t2<t1) { k=j, l=i, t1=t2;}
+	/*
+	 *	Metric kernels. Each kernel takes two observations stored contiguously
+	 *	and uses four independent accumulators so that the inner loop can be
+	 *	vectorized without reassociating floating point sums.
+	 */
+
+	/// Squared Euclidean distance kernel.
+	struct metric_squaredeuclidean
+	{
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+			uword i = 0;
+			for ( ; i + 3 < n ; i += 4) {
+				const double d0 = a[i] - b[i], d1 = a[i + 1] - b[i + 1];
+				const double d2 = a[i + 2] - b[i + 2], d3 = a[i + 3] - b[i + 3];
+				s0 += d0 * d0; s1 += d1 * d1; s2 += d2 * d2; s3 += d3 * d3;
 			}
+			for ( ; i < n ; i++) {
+				const double d = a[i] - b[i];
+				s0 += d * d;
 			}
-			*/
+			return (s0 + s1) + (s2 + s3);
+		}
+	};
 
-			/*  NEW METHOD: Keeps a sorted vector "T" with the N minimum distances,
-			at every branch iteration we only pick the first entry. Now the whole
-			"y" is not searched at every step, we will search it again only when
-			all the entries in "T" have been used or invalidated. However, we need
-			to keep track of invalid distances already sorted in "y", and also
-			update the index vectors "K" and "L" with permutations occurred in the
-			half matrix "y"
-			*/
+	/// Euclidean distance kernel.
+	struct metric_euclidean
+	{
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			return std::sqrt(metric_squaredeuclidean()(a, b, n));
+		}
+	};
 
-			/* cuts "T" so it does not contain any distance greater than any of the
-			new distances computed when joined the last clusters ("t3" contains
-			the minimum new distance computed in the last iteration). */
-			for (h=0;((T[h]<t3) && (h<sT));h++);
-			sT = h; t3 = inf;
-			/* ONLY when "T" is empty it searches again "y" for the N minimum
-			distances  */
-			if (sT==0) {
-				for (h=0; h<N; T[h++]=inf);
-				p1 = ((m2m1 - bc) * bc) >> 1; /* finds where the matrix starts */
-				for (j=bc; j<m; j++) {
-					for (i=j+1; i<m; i++) {
-						t2 = y[p1++];
-						/*  this would be needed to solve NaN bug in MSVC*/
-						/*  if (!mxIsNaN(t2)) { */
-						if (t2 <= T[N-1]) {
-							for (h=N-1; ((h>0) && (t2 <= T[h-1])); h--) {
-								T[h]=T[h-1];
-								K[h]=K[h-1];
-								L[h]=L[h-1];
-							} /* for (h=N-1 ... */
-							T[h] = t2;
-							K[h] = j;
-							L[h] = i;
-							sT++;
-						} /* if (t2<T[N-1]) */
-						/*}*/
-					} /*  for (i= ... */
-				} /* for (j= ... */
-				if (sT>N) sT=N;
-			} /* if (sT<1) */
+	/// City block distance kernel.
+	struct metric_cityblock
+	{
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+			uword i = 0;
+			for ( ; i + 3 < n ; i += 4) {
+				s0 += std::abs(a[i] - b[i]);
+				s1 += std::abs(a[i + 1] - b[i + 1]);
+				s2 += std::abs(a[i + 2] - b[i + 2]);
+				s3 += std::abs(a[i + 3] - b[i + 3]);
+			}
+			for ( ; i < n ; i++)
+				s0 += std::abs(a[i] - b[i]);
+			return (s0 + s1) + (s2 + s3);
+		}
+	};
 
-			/* if sT==0 but bc<bn then the remaining distances in "T" must be
-			NaN's ! we break the loop, but still need to fill the remaining
-			output rows with linkage info and NaN distances
-			*/
-			if (sT==0) break;
+	/// Minkowski distance kernel with an arbitrary exponent.
+	struct metric_minkowski
+	{
+		double p;
 
+		explicit metric_minkowski(const double exponent) : p(exponent) {}
 
-			/* the first entry in the ordered vector of distances "T" is the one
-			that will be used for this branch, "k" and "l" are its indexes */
-			k=K[0]; l=L[0]; t1=T[0];
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			double s = 0;
+			for (uword i = 0 ; i < n ; i++)
+				s += std::pow(std::abs(a[i] - b[i]), p);
+			return std::pow(s, 1 / p);
+		}
+	};
 
-			/* some housekeeping over "T" to inactivate all the other minimum
-			distances which also have a "k" or "l" index, and then also take
-			care of those indexes of the distances which are in the leftmost
-			column */
-			for (h=0,i=1;i<sT;i++) {
-				/* test if the other entries of "T" belong to the branch "k" or "l"
-				if it is true, do not move them in to the updated "T" because
+	/// Chebychev distance kernel.
+	struct metric_chebychev
+	{
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			double s0 = 0, s1 = 0;
+			uword i = 0;
+			for ( ; i + 1 < n ; i += 2) {
+				s0 = std::max(s0, std::abs(a[i] - b[i]));
+				s1 = std::max(s1, std::abs(a[i + 1] - b[i + 1]));
+			}
+			if (i < n) s0 = std::max(s0, std::abs(a[i] - b[i]));
+			return std::max(s0, s1);
+		}
+	};
+
+	/// One minus the inner product of normalized observations (cosine, correlation and spearman), clamped at 0 for the inner products rounded above 1.
+	struct metric_dot
+	{
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+			uword i = 0;
+			for ( ; i + 3 < n ; i += 4) {
+				s0 += a[i] * b[i];
+				s1 += a[i + 1] * b[i + 1];
+				s2 += a[i + 2] * b[i + 2];
+				s3 += a[i + 3] * b[i + 3];
+			}
+			for ( ; i < n ; i++)
+				s0 += a[i] * b[i];
+			const double g = (s0 + s1) + (s2 + s3);
+			return g > 1 ? 0 : 1 - g;
+		}
+	};
+
+	/// Hamming distance kernel.
+	struct metric_hamming
+	{
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			uword c = 0;
+			for (uword i = 0 ; i < n ; i++)
+				c += (a[i] != b[i]);
+			return (double)c / n;
+		}
+	};
+
+	/// Jaccard distance kernel. Two observations without any nonzero coordinate have zero distance.
+	struct metric_jaccard
+	{
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			uword ne = 0, nz = 0;
+			for (uword i = 0 ; i < n ; i++) {
+				const uword z = (a[i] != 0) | (b[i] != 0);
+				nz += z;
+				ne += z & (a[i] != b[i]);
+			}
+			return nz ? (double)ne / nz : 0.0;
+		}
+	};
+
+	/*
+	 *	Inner product forms of the metrics, evaluated from the squared norms of
+	 *	two observations and their inner product.
+	 */
+
+	/// Squared Euclidean distance from inner products. Cancellation is clamped so that the result is never negative.
+	struct gram_squaredeuclidean
+	{
+		inline double operator()(const double na, const double nb, const double g) const
+		{
+			const double d = na + nb - 2 * g;
+			return d < 0 ? 0 : d;
+		}
+	};
+
+	/// Euclidean distance from inner products.
+	struct gram_euclidean
+	{
+		inline double operator()(const double na, const double nb, const double g) const
+		{
+			return std::sqrt(gram_squaredeuclidean()(na, nb, g));
+		}
+	};
+
+	/// One minus the inner product of normalized observations, clamped at 0 for the inner products rounded above 1.
+	struct gram_dot
+	{
+		inline double operator()(const double /*na*/, const double /*nb*/, const double g) const
+		{
+			return g > 1 ? 0 : 1 - g;
+		}
+	};
+
+	/// Replace each element of [ptr, ptr + n) by its rank, averaging the ranks of ties.
+	inline void pdist_tiedrank(double* ptr, const uword n, std::vector<std::pair<double, uword> >& buf)
+	{
+		buf.resize(n);
+		for (uword i = 0 ; i < n ; i++)
+			buf[i] = std::make_pair(ptr[i], i);
+		std::sort(buf.begin(), buf.end());
+
+		for (uword i = 0 ; i < n ; ) {
+			uword j = i + 1;
+			while (j < n && buf[j].first == buf[i].first) j++;
+			const double r = (i + j + 1) / 2.0;	// average of the 1-based ranks i+1, ..., j
+			for (uword k = i ; k < j ; k++)
+				ptr[buf[k].second] = r;
+			i = j;
+		}
+	}
+
+	/**
+	 *	Metric parameters estimated from the data.
+	 *	The observations are packed as the columns of an n-by-m matrix, and transformed so that
+	 *	seuclidean and mahalanobis reduce to the Euclidean kernel and cosine, correlation and
+	 *	spearman reduce to an inner product.
+	 */
+	struct pdist_metric
+	{
+		distance_type type;
+		double exponent;
+		vec scale;	///< inverse standard deviation of each variable (seuclidean)
+		mat R;		///< upper Cholesky factor of the sample covariance (mahalanobis)
+		vec mu;		///< mean of each variable (fasteuclidean, fastsquaredeuclidean)
+
+		pdist_metric(const mat& X, const distance_type type_, const double exponent_ = 2)
+			: type(type_), exponent(exponent_)
+		{
+			switch (type) {
+			case seuclidean:
+				scale = 1 / trans(stddev(X));
+				break;
+			case mahalanobis:
+				if (!chol(R, cov(X)))
+					throw std::invalid_argument("The covariance matrix of X must be positive definite.");
+				break;
+			case minkowski:
+				if (!(exponent > 0))
+					throw std::invalid_argument("The Minkowski exponent must be positive.");
+				break;
+			case fasteuclidean:
+			case fastsquaredeuclidean:
+				mu = trans(mean(X));
+				break;
+			default:
+				break;
+			}
+		}
+
+		/// Returns the observations of X as contiguous columns, transformed for the kernel.
+		mat pack(const mat& X) const
+		{
+			mat P = trans(X);
+			const uword n = P.n_rows, m = P.n_cols;
+
+			switch (type) {
+			case seuclidean:
+				for (uword j = 0 ; j < m ; j++) {
+					double* p = P.colptr(j);
+					for (uword i = 0 ; i < n ; i++) p[i] *= scale[i];
+				}
+				break;
+			case mahalanobis:
+				P = solve(trimatl(trans(R)), P);
+				break;
+			case fasteuclidean:
+			case fastsquaredeuclidean:
+				// distances are invariant to translation, and centering reduces
+				// the cancellation in the inner product form
+				{
+					for (uword j = 0 ; j < m ; j++) {
+						double* p = P.colptr(j);
+						for (uword i = 0 ; i < n ; i++) p[i] -= mu[i];
+					}
+				}
+				break;
+			case spearman:
+				{
+					std::vector<std::pair<double, uword> > buf;
+					for (uword j = 0 ; j < m ; j++)
+						pdist_tiedrank(P.colptr(j), n, buf);
+				}
+				// ranks are correlated
+				// fall through
+			case correlation:
+				for (uword j = 0 ; j < m ; j++) {
+					double* p = P.colptr(j);
+					double mu = 0;
+					for (uword i = 0 ; i < n ; i++) mu += p[i];
+					mu /= n;
+					for (uword i = 0 ; i < n ; i++) p[i] -= mu;
+				}
+				// centered observations are normalized
+				// fall through
+			case cosine:
+				for (uword j = 0 ; j < m ; j++) {
+					double* p = P.colptr(j);
+					double s = 0;
+					for (uword i = 0 ; i < n ; i++) s += p[i] * p[i];
+					s = 1 / std::sqrt(s);
+					for (uword i = 0 ; i < n ; i++) p[i] *= s;
+				}
+				break;
+			default:
+				break;
+			}
+
+			return P;
+		}
+	};
+
+	/// Computes the distances of the pairs (i, j), i0 <= i < i1, j0 <= j < j1, i < j.
+	template <typename eT, typename oT, typename metric_type>
+	inline void pdist_tile(const Mat<eT>& P, condensed_distance<oT>& D, const metric_type& metric,
+		const uword i0, const uword i1, const uword j0, const uword j1)
+	{
+		const uword n = P.n_rows;
+
+		for (uword i = i0 ; i < i1 ; i++) {
+			const uword jb = std::max(j0, i + 1);
+			if (jb >= j1) continue;
+
+			const eT* a = P.colptr(i);
+			oT* dst = D.memptr() + D.offset(i, jb);
+			for (uword j = jb ; j < j1 ; j++)
+				*dst++ = (oT)metric(a, P.colptr(j), n);
+		}
+	}
+
+	/// Number of tiles before the block row I in the upper triangle of nb-by-nb tiles.
+	inline uword pdist_tile_offset(const uword nb, const uword I)
+	{
+		return I * nb - I * (I - 1) / 2;
+	}
+
+	/// Block row of the t-th tile in the upper triangle of nb-by-nb tiles, enumerated row by row.
+	inline uword pdist_tile_row(const uword nb, const uword t)
+	{
+		const double b = 2.0 * nb + 1;
+		uword I = (uword)((b - std::sqrt(b * b - 8.0 * t)) / 2);
+
+		// correct the rounding of the square root
+		while (I > 0 && pdist_tile_offset(nb, I) > t) I--;
+		while (pdist_tile_offset(nb, I + 1) <= t) I++;
+
+		return I;
+	}
+
+	/**
+	 *	Computes the condensed distances of the packed observations P tile by tile, for the
+	 *	pairs (i, j) with r0 <= i < r1.
+	 *	The upper triangle of the pairs is split into square tiles of equal work (the diagonal
+	 *	tiles are half full), and each tile derives its block and its output offsets from its
+	 *	index, so the tiles are computed independently in parallel.
+	 */
+	template <typename eT, typename oT, typename metric_type>
+	void pdist_tiles(const Mat<eT>& P, condensed_distance<oT>& D, const metric_type& metric, const uword r0, const uword r1)
+	{
+		const uword m = P.n_cols;
+		const uword bs = pdist_block_size(P.n_rows);
+		const uword nb = (m - r0 + bs - 1) / bs;	// column blocks of the grid starting at r0
+		const uword nt = pdist_tile_offset(nb, (r1 - r0 + bs - 1) / bs);
+
+		ARMA_EXT_PARALLEL_FOR_DYNAMIC(t, nt, 1)
+			const uword I = pdist_tile_row(nb, t);
+			const uword J = I + (t - pdist_tile_offset(nb, I));
+
+			const uword i0 = r0 + I * bs, j0 = r0 + J * bs;
+			pdist_tile(P, D, metric, i0, std::min(i0 + bs, r1), j0, std::min(j0 + bs, m));
+		ARMA_EXT_PARALLEL_END
+	}
+
+	/**
+	 *	Computes D(i, j), the distance between the packed observations PX.col(i) and PY.col(j).
+	 *	The pairs are split into tiles of cache-sized blocks of both sets, which are computed in parallel.
+	 */
+	struct pdist2_tiles
+	{
+		template <typename eT, typename metric_type>
+		static void apply(const Mat<eT>& PX, const Mat<eT>& PY, mat& D, const metric_type& metric)
+		{
+			const uword n = PX.n_rows, mx = PX.n_cols, my = PY.n_cols;
+			const uword bs = pdist_block_size(n);
+			const uword nbx = (mx + bs - 1) / bs, nt = nbx * ((my + bs - 1) / bs);
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(t, nt, 1)
+				const uword i0 = (t % nbx) * bs, j0 = (t / nbx) * bs;
+				const uword i1 = std::min(i0 + bs, mx), j1 = std::min(j0 + bs, my);
+
+				for (uword j = j0 ; j < j1 ; j++) {
+					const eT* b = PY.colptr(j);
+					double* dst = D.colptr(j);
+					for (uword i = i0 ; i < i1 ; i++)
+						dst[i] = metric(PX.colptr(i), b, n);
+				}
+			ARMA_EXT_PARALLEL_END
+		}
+	};
+
+	/// Number of set bits of x.
+	inline uword popcount(u64 x)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		return (uword)__popcnt64(x);
+#elif defined(__GNUC__)
+		return (uword)__builtin_popcountll(x);
+#else
+		x = x - ((x >> 1) & 0x5555555555555555ULL);
+		x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+		x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+		return (uword)((x * 0x0101010101010101ULL) >> 56);
+#endif
+	}
+
+	/// Hamming distance kernel of bit-packed observations of w words, divided by the number of bits.
+	struct metric_bit_hamming
+	{
+		double scale;
+
+		explicit metric_bit_hamming(const uword nbits) : scale(1.0 / nbits) {}
+
+		inline double operator()(const u64* a, const u64* b, const uword w) const
+		{
+			uword s0 = 0, s1 = 0;
+			uword i = 0;
+			for ( ; i + 1 < w ; i += 2) {
+				s0 += popcount(a[i] ^ b[i]);
+				s1 += popcount(a[i + 1] ^ b[i + 1]);
+			}
+			if (i < w) s0 += popcount(a[i] ^ b[i]);
+			return (s0 + s1) * scale;
+		}
+	};
+
+	/// Jaccard distance kernel of bit-packed observations of w words; zero if both observations are zero.
+	struct metric_bit_jaccard
+	{
+		inline double operator()(const u64* a, const u64* b, const uword w) const
+		{
+			uword diff = 0, nz = 0;
+			for (uword i = 0 ; i < w ; i++) {
+				diff += popcount(a[i] ^ b[i]);
+				nz += popcount(a[i] | b[i]);
+			}
+			return nz ? (double)diff / nz : 0;
+		}
+	};
+
+	/// Validates the number of bits of the bit-packed observations of w words; zero means all the bits.
+	inline uword pdist_bits(const distance_type type, const uword w, uword nbits)
+	{
+		if (type != hamming && type != jaccard)
+			throw std::invalid_argument("Bit-packed observations support the hamming and jaccard distances only.");
+		if (nbits == 0) nbits = 64 * w;
+		if (nbits > 64 * w)
+			throw std::invalid_argument("The number of bits exceeds the bit-packed observations.");
+		return nbits;
+	}
+
+	/**
+	 *	Computes the condensed distances of the packed observations P, for the pairs (i, j) with
+	 *	r0 <= i < r1, from the inner products of tiles of observations, so that the bulk of the
+	 *	work is done by BLAS (syrk on the diagonal tiles, gemm elsewhere).
+	 */
+	template <typename gram_type>
+	void pdist_gram(const mat& P, condensed_distance<double>& D, const gram_type& f, const uword r0, const uword r1)
+	{
+		const uword n = P.n_rows, m = P.n_cols;
+		const uword bs = 512;
+
+		vec nrm(m);
+		for (uword j = r0 ; j < m ; j++) {
+			const double* p = P.colptr(j);
+			double s = 0;
+			for (uword i = 0 ; i < n ; i++) s += p[i] * p[i];
+			nrm[j] = s;
+		}
+
+		mat G;
+		for (uword i0 = r0 ; i0 < r1 ; i0 += bs) {
+			const uword i1 = std::min(i0 + bs, r1);
+			const mat A(const_cast<double*>(P.colptr(i0)), n, i1 - i0, false, true);
+
+			for (uword j0 = i0 ; j0 < m ; j0 += bs) {
+				const uword j1 = std::min(j0 + bs, m);
+
+				// G(j - j0, i - i0) is the inner product of the observations i and j
+				if (j0 == i0)
+					G = trans(A) * A;
+				else {
+					const mat B(const_cast<double*>(P.colptr(j0)), n, j1 - j0, false, true);
+					G = trans(B) * A;
+				}
+
+				for (uword i = i0 ; i < i1 ; i++) {
+					const uword jb = std::max(j0, i + 1);
+					if (jb >= j1) continue;
+
+					const double* g = G.colptr(i - i0) + (jb - j0);
+					double* dst = D.memptr() + D.offset(i, jb);
+					for (uword j = jb ; j < j1 ; j++)
+						*dst++ = f(nrm[i], nrm[j], *g++);
+				}
+			}
+		}
+	}
+
+	/// Computes the condensed distances of the packed observations P, for the pairs (i, j) with r0 <= i < r1.
+	inline void pdist_apply(const pdist_metric& metric, const mat& P, condensed_distance<double>& D, const uword r0, const uword r1)
+	{
+		switch (metric.type) {
+		case euclidean:
+		case seuclidean:
+		case mahalanobis:
+			pdist_tiles(P, D, metric_euclidean(), r0, r1);
+			break;
+		case cityblock:
+			pdist_tiles(P, D, metric_cityblock(), r0, r1);
+			break;
+		case minkowski:
+			if (metric.exponent == 1)
+				pdist_tiles(P, D, metric_cityblock(), r0, r1);
+			else if (metric.exponent == 2)
+				pdist_tiles(P, D, metric_euclidean(), r0, r1);
+			else if (metric.exponent == datum::inf)
+				pdist_tiles(P, D, metric_chebychev(), r0, r1);
+			else
+				pdist_tiles(P, D, metric_minkowski(metric.exponent), r0, r1);
+			break;
+		case chebychev:
+			pdist_tiles(P, D, metric_chebychev(), r0, r1);
+			break;
+		case cosine:
+		case correlation:
+		case spearman:
+			pdist_gram(P, D, gram_dot(), r0, r1);
+			break;
+		case squaredeuclidean:
+			pdist_tiles(P, D, metric_squaredeuclidean(), r0, r1);
+			break;
+		case fasteuclidean:
+			pdist_gram(P, D, gram_euclidean(), r0, r1);
+			break;
+		case fastsquaredeuclidean:
+			pdist_gram(P, D, gram_squaredeuclidean(), r0, r1);
+			break;
+		case hamming:
+			pdist_tiles(P, D, metric_hamming(), r0, r1);
+			break;
+		case jaccard:
+			pdist_tiles(P, D, metric_jaccard(), r0, r1);
+			break;
+		default:
+			throw std::invalid_argument("Unsupported distance type.");
+		}
+	}
+
+	/// Adapts a distance function between rows of X to a kernel over the packed observations P = trans(X).
+	struct pdist_func_kernel
+	{
+		const mat& X;
+		const double* base;
+		pdist_func func;
+
+		pdist_func_kernel(const mat& X_, const mat& P, pdist_func func_) : X(X_), base(P.memptr()), func(func_) {}
+
+		inline double operator()(const double* a, const double* b, const uword n) const
+		{
+			return func(X.row((a - base) / n), X.row((b - base) / n));
+		}
+	};
+
+	/**
+	 *	Calls task_type::apply(args..., kernel) with the kernel that computes the distance between two packed
+	 *	observations, so that each algorithm over the packed observations is written once for all the kernels.
+	 */
+	template <typename task_type, typename... arg_types>
+	inline void pdist_dispatch(const pdist_metric& metric, arg_types&&... args)
+	{
+		switch (metric.type) {
+		case euclidean:
+		case seuclidean:
+		case mahalanobis:
+		case fasteuclidean:
+			task_type::apply(args..., metric_euclidean());
+			break;
+		case cityblock:
+			task_type::apply(args..., metric_cityblock());
+			break;
+		case minkowski:
+			if (metric.exponent == 1)
+				task_type::apply(args..., metric_cityblock());
+			else if (metric.exponent == 2)
+				task_type::apply(args..., metric_euclidean());
+			else if (metric.exponent == datum::inf)
+				task_type::apply(args..., metric_chebychev());
+			else
+				task_type::apply(args..., metric_minkowski(metric.exponent));
+			break;
+		case chebychev:
+			task_type::apply(args..., metric_chebychev());
+			break;
+		case cosine:
+		case correlation:
+		case spearman:
+			task_type::apply(args..., metric_dot());
+			break;
+		case squaredeuclidean:
+		case fastsquaredeuclidean:
+			task_type::apply(args..., metric_squaredeuclidean());
+			break;
+		case hamming:
+			task_type::apply(args..., metric_hamming());
+			break;
+		case jaccard:
+			task_type::apply(args..., metric_jaccard());
+			break;
+		default:
+			throw std::invalid_argument("Unsupported distance type.");
+		}
+	}
+
+	/**
+	 *	Computes D(i, j) from the inner products of the packed observations PX.col(i) and PY.col(j) with BLAS,
+	 *	as pdist_gram does for a single set.
+	 */
+	template <typename gram_type>
+	void pdist2_gram(const mat& PX, const mat& PY, mat& D, const gram_type& f)
+	{
+		const uword n = PX.n_rows, mx = PX.n_cols, my = PY.n_cols;
+
+		vec nx(mx), ny(my);
+		for (uword i = 0 ; i < mx ; i++) {
+			const double* p = PX.colptr(i);
+			double s = 0;
+			for (uword l = 0 ; l < n ; l++) s += p[l] * p[l];
+			nx[i] = s;
+		}
+		for (uword j = 0 ; j < my ; j++) {
+			const double* p = PY.colptr(j);
+			double s = 0;
+			for (uword l = 0 ; l < n ; l++) s += p[l] * p[l];
+			ny[j] = s;
+		}
+
+		D = trans(PX) * PY;
+
+		ARMA_EXT_PARALLEL_FOR(j, my)
+			double* g = D.colptr(j);
+			for (uword i = 0 ; i < mx ; i++)
+				g[i] = f(nx[i], ny[j], g[i]);
+		ARMA_EXT_PARALLEL_END
+	}
+
+	/// Entry of the smallest distances of a query, ordered by distance and then by index; NaN is the largest.
+	struct pdist2_entry
+	{
+		double d;
+		uword i;
+
+		bool operator<(const pdist2_entry& o) const
+		{
+			const bool na = (d != d), nb = (o.d != o.d);
+			if (na || nb) return (na && nb) ? i < o.i : nb;
+			return d < o.d || (d == o.d && i < o.i);
+		}
+	};
+
+	/**
+	 *	For each packed query PY.col(j), finds the k nearest packed references PX.col(i), 0 < k <= PX.n_cols.
+	 *	The references are streamed in cache-sized tiles through a bounded max-heap per query, so only k
+	 *	distances per query are kept. The blocks of queries are processed in parallel.
+	 */
+	struct pdist2_smallest
+	{
+		template <typename eT, typename metric_type>
+		static void apply(const Mat<eT>& PX, const Mat<eT>& PY, const uword k, mat& D, umat& I, const metric_type& metric)
+		{
+			const uword n = PX.n_rows, mx = PX.n_cols, my = PY.n_cols;
+			const uword bs = pdist_block_size(n);
+			const uword nb = (my + bs - 1) / bs;
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(b, nb, 1)
+				const uword j0 = b * bs, j1 = std::min(j0 + bs, my);
+				std::vector<pdist2_entry> heap((j1 - j0) * k);
+				std::vector<uword> size(j1 - j0, 0);
+
+				for (uword i0 = 0 ; i0 < mx ; i0 += bs) {
+					const uword i1 = std::min(i0 + bs, mx);
+
+					for (uword j = j0 ; j < j1 ; j++) {
+						const eT* q = PY.colptr(j);
+						pdist2_entry* h = &heap[(j - j0) * k];
+						uword& hs = size[j - j0];
+
+						for (uword i = i0 ; i < i1 ; i++) {
+							const pdist2_entry e = { metric(PX.colptr(i), q, n), i };
+							if (hs < k) {
+								h[hs++] = e;
+								std::push_heap(h, h + hs);
+							}
+							else if (e < h[0]) {
+								std::pop_heap(h, h + k);
+								h[k - 1] = e;
+								std::push_heap(h, h + k);
+							}
+						}
+					}
+				}
+
+				for (uword j = j0 ; j < j1 ; j++) {
+					pdist2_entry* h = &heap[(j - j0) * k];
+					std::sort_heap(h, h + k);
+
+					double* d = D.colptr(j);
+					uword* idx = I.colptr(j);
+					for (uword r = 0 ; r < k ; r++) {
+						d[r] = h[r].d;
+						idx[r] = h[r].i;
+					}
+				}
+			ARMA_EXT_PARALLEL_END
+		}
+	};
+#endif
+
+	/**
+	 *	@brief	Pairwise distance between pairs of objects.<br>
+	 *			Computes the distance between pairs of objects in \f$m\f$-by-\f$n\f$ data matrix \f$X\f$.<br>
+	 *			Rows of \f$X\f$ correspond to observations, and columns correspond to variables.
+	 *			Output is the row vector of length \f$ \frac{m(m - 1)}{2} \f$, corresponding to pairs of observations in \f$X\f$.<br>
+	 *			The distances are arranged in the order \f$(2, 1), (3, 1), \cdots, (m, 1), (3, 2), \cdots, (m, 2), \cdots, (m, m - 1)\f$.<br>
+	 *			Output is commonly used as a dissimilarity matrix in clustering or multidimensional scailing.
+	 *	@param X		The data matrix.
+	 *	@param type		The distance metric.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	Pairwise distance.
+	 *	@note	The observations are packed once and the pairs are computed in cache-sized tiles.
+	 *			#cosine, #correlation, #spearman, #fasteuclidean and #fastsquaredeuclidean are computed
+	 *			from the inner products of tiles of observations with BLAS.
+	 */
+	inline vec pdist(const mat& X, distance_type type, double exponent)
+	{
+		const uword m = X.n_rows;
+		vec Y(m * (m - 1) / 2);
+
+		condensed_distance<double> D(Y.memptr(), m);
+		const pdist_metric metric(X, type, exponent);
+		pdist_apply(metric, metric.pack(X), D, 0, m);
+
+		return Y;
+	}
+
+	/**
+	 *	@brief	Pairwise distance between pairs of objects.
+	 *	@param X		The data matrix.
+	 *	@param type		The distance metric.
+	 *	@param func_ptr	The distance function between two rows of @c X, used when @c type is #custom.
+	 *					It is called concurrently.
+	 *	@return	Pairwise distance.
+	 *	@see	pdist(const mat&, distance_type, double)
+	 *	@see	pdist(const Mat<eT>&, const func_type&), which calls an inline function over contiguous spans
+	 */
+	inline vec pdist(const mat& X, distance_type type = euclidean, pdist_func func_ptr = nullptr)
+	{
+		if (type != custom)
+			return pdist(X, type, 2.0);
+
+		if (func_ptr == nullptr)
+			throw std::invalid_argument("A distance function is required for the custom distance type.");
+
+		const uword m = X.n_rows;
+		vec Y(m * (m - 1) / 2);
+		condensed_distance<double> D(Y.memptr(), m);
+		if (X.n_cols == 0) {	// the rows cannot be told apart by their packed spans
+			for (uword i = 0 ; i < m ; i++)
+				for (uword j = i + 1 ; j < m ; j++)
+					D.memptr()[D.offset(i, j)] = func_ptr(X.row(i), X.row(j));
+			return Y;
+		}
+
+		const mat P = trans(X);
+		pdist_tiles(P, D, pdist_func_kernel(X, P, func_ptr), 0, m);
+
+		return Y;
+	}
+
+	/**
+	 *	@brief	Pairwise distance between pairs of objects, with a distance function.<br>
+	 *			The observations are packed as contiguous spans once, and the pairs are computed in tiles, in parallel,
+	 *			as for the built-in metrics, so that an inline function object is as fast as them.
+	 *	@param X	The data matrix.
+	 *	@param func	The distance function, which is called as @c func(a, b, n) with the pointers to two observations
+	 *				of @c n contiguous elements. It is called concurrently.
+	 *	@return	Pairwise distance.
+	 *	@see	pdist(const mat&, distance_type, double)
+	 */
+	template <typename eT, typename func_type>
+	inline typename std::enable_if<!std::is_same<func_type, distance_type>::value, Col<eT> >::type
+	pdist(const Mat<eT>& X, const func_type& func)
+	{
+		const uword m = X.n_rows;
+		Col<eT> Y(m * (m - 1) / 2);
+
+		condensed_distance<eT> D(Y.memptr(), m);
+		const Mat<eT> P = trans(X);
+		pdist_tiles(P, D, func, 0, m);
+
+		return Y;
+	}
+
+	/**
+	 *	@brief	Packs the rows of X as bits, for the bit-packed #hamming and #jaccard distances.<br>
+	 *			The element j of a row, nonzero or zero, is the bit (j % 64) of the word (j / 64) of the row.
+	 *	@param X	The data matrix, whose elements are taken as logical values.
+	 *	@return	The \f$m\f$-by-\f$\lceil n / 64 \rceil\f$ matrix of words.
+	 */
+	template <typename eT>
+	inline Mat<u64> bitpack(const Mat<eT>& X)
+	{
+		const uword m = X.n_rows, n = X.n_cols;
+		Mat<u64> B(m, (n + 63) / 64);
+		B.zeros();
+
+		for (uword j = 0 ; j < n ; j++) {
+			const eT* x = X.colptr(j);
+			u64* b = B.colptr(j / 64);
+			const u64 bit = u64(1) << (j % 64);
+			for (uword i = 0 ; i < m ; i++)
+				if (x[i] != eT(0)) b[i] |= bit;
+		}
+
+		return B;
+	}
+
+	/**
+	 *	@brief	Pairwise #hamming or #jaccard distance between bit-packed observations.<br>
+	 *			The distances are arranged as by #pdist, and are computed with the population count of words.
+	 *	@param X		The bit-packed data matrix, one observation of 64-bit words per row, as generated by #bitpack.
+	 *	@param type		The distance metric, #hamming or #jaccard.
+	 *	@param nbits	The number of bits of each observation, which is the divisor of the hamming distance.
+	 *					Zero means all the bits of the words. The bits beyond @c nbits must be zero.
+	 *	@return	Pairwise distance.
+	 *	@note	The population count uses the POPCNT instruction when the compiler targets it (e.g. -mpopcnt).
+	 */
+	inline vec pdist(const Mat<u64>& X, distance_type type = hamming, uword nbits = 0)
+	{
+		const uword m = X.n_rows;
+		nbits = pdist_bits(type, X.n_cols, nbits);
+
+		vec Y(m * (m - 1) / 2);
+		condensed_distance<double> D(Y.memptr(), m);
+		const Mat<u64> P = trans(X);
+
+		if (type == hamming)
+			pdist_tiles(P, D, metric_bit_hamming(nbits), 0, m);
+		else
+			pdist_tiles(P, D, metric_bit_jaccard(), 0, m);
+
+		return Y;
+	}
+
+	/**
+	 *	@brief	Pairwise #hamming or #jaccard distance between two sets of bit-packed observations.
+	 *	@param X		The bit-packed data matrix.
+	 *	@param Y		The other bit-packed data matrix, of the same number of words.
+	 *	@param type		The distance metric, #hamming or #jaccard.
+	 *	@param nbits	The number of bits of each observation; zero means all the bits of the words.
+	 *	@return	The matrix of distances, whose element (i, j) is the distance between the rows i of X and j of Y.
+	 *	@see	pdist(const Mat<u64>&, distance_type, uword)
+	 */
+	inline mat pdist2(const Mat<u64>& X, const Mat<u64>& Y, distance_type type = hamming, uword nbits = 0)
+	{
+		if (X.n_cols != Y.n_cols)
+			throw std::invalid_argument("X and Y must have the same number of words.");
+		nbits = pdist_bits(type, X.n_cols, nbits);
+
+		mat D(X.n_rows, Y.n_rows);
+		const Mat<u64> PX = trans(X), PY = trans(Y);
+
+		if (type == hamming)
+			pdist2_tiles::apply(PX, PY, D, metric_bit_hamming(nbits));
+		else
+			pdist2_tiles::apply(PX, PY, D, metric_bit_jaccard());
+
+		return D;
+	}
+
+	/**
+	 *	@brief	Pairwise distance between two sets of observations.<br>
+	 *			Rows of \f$X\f$ and \f$Y\f$ correspond to observations, and columns correspond to variables.
+	 *	@param X		The \f$m_x\f$-by-\f$n\f$ data matrix.
+	 *	@param Y		The \f$m_y\f$-by-\f$n\f$ data matrix.
+	 *	@param type		The distance metric. The statistics of #seuclidean and #mahalanobis are estimated from X.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	The \f$m_x\f$-by-\f$m_y\f$ matrix, whose element (i, j) is the distance between the rows i of X and j of Y.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/pdist2.html
+	 *	@note	The observations are packed once and the pairs are computed in cache-sized tiles in parallel, with the kernels of #pdist.
+	 */
+	inline mat pdist2(const mat& X, const mat& Y, distance_type type = euclidean, double exponent = 2)
+	{
+		if (X.n_cols != Y.n_cols)
+			throw std::invalid_argument("X and Y must have the same number of columns.");
+
+		const pdist_metric metric(X, type, exponent);
+		const mat PX = metric.pack(X), PY = metric.pack(Y);
+		mat D(X.n_rows, Y.n_rows);
+
+		switch (type) {
+		case cosine:
+		case correlation:
+		case spearman:
+			pdist2_gram(PX, PY, D, gram_dot());
+			break;
+		case fasteuclidean:
+			pdist2_gram(PX, PY, D, gram_euclidean());
+			break;
+		case fastsquaredeuclidean:
+			pdist2_gram(PX, PY, D, gram_squaredeuclidean());
+			break;
+		default:
+			{
+				pdist_dispatch<pdist2_tiles>(metric, PX, PY, D);
+			}
+			break;
+		}
+
+		return D;
+	}
+
+	/**
+	 *	@brief	The k smallest distances from each observation of Y to the observations of X.<br>
+	 *			The full \f$m_x\f$-by-\f$m_y\f$ matrix is never formed; the observations of X are streamed in tiles
+	 *			through a bounded heap per observation of Y, and the observations of Y are processed in parallel.
+	 *	@param X		The \f$m_x\f$-by-\f$n\f$ data matrix of the references.
+	 *	@param Y		The \f$m_y\f$-by-\f$n\f$ data matrix of the queries.
+	 *	@param I		The indices of the nearest observations: I(r, j) is the (0-based) row of X of the r-th nearest observation to the row j of Y.
+	 *	@param k		The number of smallest distances. At most \f$m_x\f$ are returned.
+	 *	@param type		The distance metric. The statistics of #seuclidean and #mahalanobis are estimated from X.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	The \f$k\f$-by-\f$m_y\f$ matrix of the smallest distances in ascending order; ties are ordered by index.
+	 *	@see	pdist2(const mat&, const mat&, distance_type, double)
+	 */
+	inline mat pdist2(const mat& X, const mat& Y, umat& I, uword k, distance_type type = euclidean, double exponent = 2)
+	{
+		if (X.n_cols != Y.n_cols)
+			throw std::invalid_argument("X and Y must have the same number of columns.");
+
+		k = std::min(k, (uword)X.n_rows);
+		mat D(k, Y.n_rows);
+		I.set_size(k, Y.n_rows);
+		if (k == 0) return D;
+
+		const pdist_metric metric(X, type, exponent);
+		const mat PX = metric.pack(X), PY = metric.pack(Y);
+
+		pdist_dispatch<pdist2_smallest>(metric, PX, PY, k, D, I);
+
+		return D;
+	}
+
+	/**
+	 *	@brief	Pairwise distance between pairs of objects, written to a memory-mapped file.<br>
+	 *			The distances are computed in bands of observations, and each band is written back to
+	 *			the file before the next one, so that the condensed distances never reside in memory at once.
+	 *	@param X		The data matrix.
+	 *	@param filename	The file of the distances. It is created, or truncated if it exists.
+	 *	@param type		The distance metric.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	The handle of the mapped distances.
+	 *	@see	pdist(const mat&, distance_type, double)
+	 */
+	inline mapped_distance pdist_mapped(const mat& X, const std::string& filename, distance_type type = euclidean, double exponent = 2)
+	{
+		const uword m = X.n_rows;
+		mapped_distance Y(filename, m, true);
+		condensed_distance<double> D(Y);
+
+		const pdist_metric metric(X, type, exponent);
+		const mat P = metric.pack(X);
+
+		const uword band = uword(1) << 25;	// distances per band (256MB)
+
+		for (uword r0 = 0 ; r0 < m ; ) {
+			uword r1 = r0 + 1;
+			while (r1 < m && D.offset(r1, r1 + 1) - D.offset(r0, r0 + 1) < band) r1++;
+
+			pdist_apply(metric, P, D, r0, r1);
+			Y.flush(D.offset(r0, r0 + 1), D.offset(r1, r1 + 1));
+			r0 = r1;
+		}
+
+		return Y;
+	}
+
+#ifndef DOXYGEN
+	/*
+	 *	Reduced norms of the k-d tree. The reduced distance is an increasing function of the distance that
+	 *	omits the final root, and add() accumulates the reduced distance of a gap along one variable, so
+	 *	that the lower bound of the distance to a bounding box is found with the same arithmetic.
+	 */
+
+	/// Euclidean norm, reduced to the squared Euclidean distance.
+	struct kdtree_l2
+	{
+		inline double distance(const double* a, const double* b, const uword n) const { return metric_squaredeuclidean()(a, b, n); }
+		inline double add(const double s, const double g) const { return s + g * g; }
+		inline double expand(const double r) const { return std::sqrt(r); }
+	};
+
+	/// City block norm.
+	struct kdtree_l1
+	{
+		inline double distance(const double* a, const double* b, const uword n) const { return metric_cityblock()(a, b, n); }
+		inline double add(const double s, const double g) const { return s + g; }
+		inline double expand(const double r) const { return r; }
+	};
+
+	/// Chebychev norm.
+	struct kdtree_linf
+	{
+		inline double distance(const double* a, const double* b, const uword n) const { return metric_chebychev()(a, b, n); }
+		inline double add(const double s, const double g) const { return std::max(s, g); }
+		inline double expand(const double r) const { return r; }
+	};
+
+	/// Minkowski norm with an arbitrary exponent, reduced to the sum of the powers.
+	struct kdtree_lp
+	{
+		double p;
+
+		explicit kdtree_lp(const double exponent) : p(exponent) {}
+
+		inline double distance(const double* a, const double* b, const uword n) const
+		{
+			double s = 0;
+			for (uword i = 0 ; i < n ; i++)
+				s += std::pow(std::abs(a[i] - b[i]), p);
+			return s;
+		}
+		inline double add(const double s, const double g) const { return s + std::pow(g, p); }
+		inline double expand(const double r) const { return std::pow(r, 1 / p); }
+	};
+
+	/// Orders the observations of a node along one variable.
+	struct kdtree_coord_less
+	{
+		const mat& Q;
+		const uword d;
+
+		kdtree_coord_less(const mat& Q_, const uword d_) : Q(Q_), d(d_) {}
+
+		inline bool operator()(const uword a, const uword b) const
+		{
+			return Q.at(d, a) < Q.at(d, b);
+		}
+	};
+#endif
+
+	/**
+	 *	@brief	k-d tree of observations for the Minkowski family of distance metrics.<br>
+	 *			The observations are packed and reordered so that the observations of each node are
+	 *			contiguous, and the nodes and their bounding boxes are stored in flat arrays. Nodes are split
+	 *			at the median of their widest variable, and a query visits the nearer child first and skips
+	 *			the nodes whose bounding box is farther than the current bound.
+	 *			Supports #euclidean, #squaredeuclidean, #seuclidean, #cityblock, #minkowski, #chebychev,
+	 *			#mahalanobis, #fasteuclidean and #fastsquaredeuclidean.
+	 *	@note	Batch queries are processed in parallel. The results are identical to #pdist2.
+	 */
+	class kdtree
+	{
+	public:
+		/**
+		 *	@brief	Builds the tree of the observations (rows) of X.
+		 *	@param X		The \f$m\f$-by-\f$n\f$ data matrix, whose elements must be finite.
+		 *	@param type		The distance metric. The statistics of #seuclidean and #mahalanobis are estimated from X.
+		 *	@param exponent	The exponent of the Minkowski distance.
+		 *	@param leaf_size	The largest number of observations of a leaf.
+		 */
+		kdtree(const mat& X, distance_type type = euclidean, double exponent = 2, uword leaf_size = 16)
+			: metric(X, type, exponent), norm(kdtree_norm_l2), squared(false)
+		{
+			switch (type) {
+			case euclidean:
+			case seuclidean:
+			case mahalanobis:
+			case fasteuclidean:
+				break;
+			case squaredeuclidean:
+			case fastsquaredeuclidean:
+				squared = true;
+				break;
+			case cityblock:
+				norm = kdtree_norm_l1;
+				break;
+			case chebychev:
+				norm = kdtree_norm_linf;
+				break;
+			case minkowski:
+				if (exponent == 1) norm = kdtree_norm_l1;
+				else if (exponent == datum::inf) norm = kdtree_norm_linf;
+				else if (exponent != 2) norm = kdtree_norm_lp;
+				break;
+			default:
+				throw std::invalid_argument("Unsupported distance type.");
+			}
+
+			if (!X.is_finite())
+				throw std::invalid_argument("The observations must be finite.");
+
+			build(X, std::max<uword>(leaf_size, 1));
+		}
+
+		/// The number of observations.
+		uword n_obs() const { return P.n_cols; }
+
+		/**
+		 *	@brief	The k nearest observations of the tree to each observation of Y.
+		 *	@param Y	The \f$m_y\f$-by-\f$n\f$ data matrix of the queries.
+		 *	@param k	The number of nearest observations. At most #n_obs are returned.
+		 *	@param I	The indices of the nearest observations: I(r, j) is the (0-based) row of X of the r-th nearest observation to the row j of Y.
+		 *	@return	The \f$k\f$-by-\f$m_y\f$ matrix of the distances in ascending order; ties are ordered by index.
+		 *	@see	pdist2(const mat&, const mat&, umat&, uword, distance_type, double)
+		 */
+		mat knn(const mat& Y, uword k, umat& I) const
+		{
+			if (Y.n_cols != P.n_rows)
+				throw std::invalid_argument("Y must have the same number of columns as X.");
+
+			k = std::min(k, n_obs());
+			mat D(k, Y.n_rows);
+			I.set_size(k, Y.n_rows);
+			if (k == 0) return D;
+
+			knn_packed(metric.pack(Y), k, D, I);
+			return D;
+		}
+
+		/**
+		 *	@brief	The observations of the tree within distance r of each observation of Y.
+		 *	@param Y	The \f$m_y\f$-by-\f$n\f$ data matrix of the queries.
+		 *	@param r	The radius. The observations at distances \f$\le r\f$ are returned.
+		 *	@param I	I(j) holds the (0-based) rows of X of the observations within distance r of the row j of Y.
+		 *	@param D	D(j) holds their distances in ascending order; ties are ordered by index.
+		 */
+		void radius(const mat& Y, double r, field<uvec>& I, field<vec>& D) const
+		{
+			if (Y.n_cols != P.n_rows)
+				throw std::invalid_argument("Y must have the same number of columns as X.");
+
+			radius_packed(metric.pack(Y), r, I, D);
+		}
+
+#ifndef DOXYGEN
+		enum { kdtree_norm_l2, kdtree_norm_l1, kdtree_norm_linf, kdtree_norm_lp };
+
+		/// Node of the tree: the observations [begin, end) in tree order, and the children at left and left + 1 (0 for a leaf).
+		struct node
+		{
+			uword begin, end, left;
+		};
+
+		pdist_metric metric;
+		uword norm;
+		bool squared;				// the distance is the reduced Euclidean distance
+		mat P;						// packed observations in tree order
+		uvec index;					// row of X of each observation in tree order
+		std::vector<node> nodes;
+		std::vector<double> box;	// lower and upper corners of the bounding box of each node
+
+		/// Calls f with the reduced norm of the tree.
+		template <typename func_type>
+		void dispatch(func_type& f) const
+		{
+			switch (norm) {
+			case kdtree_norm_l2:	f(kdtree_l2()); break;
+			case kdtree_norm_l1:	f(kdtree_l1()); break;
+			case kdtree_norm_linf:	f(kdtree_linf()); break;
+			default:				f(kdtree_lp(metric.exponent)); break;
+			}
+		}
+
+		/// Searches the k nearest observations with the reduced norm.
+		struct knn_func
+		{
+			const kdtree& T;
+			const mat& PY;
+			const uword k;
+			mat& D;
+			umat& I;
+
+			knn_func(const kdtree& T_, const mat& PY_, const uword k_, mat& D_, umat& I_) : T(T_), PY(PY_), k(k_), D(D_), I(I_) {}
+
+			template <typename norm_type>
+			void operator()(const norm_type& f) { T.knn_batch(f, PY, k, D, I); }
+		};
+
+		/// Searches the observations within the radius with the reduced norm.
+		struct radius_func
+		{
+			const kdtree& T;
+			const mat& PY;
+			const double r;
+			field<uvec>& I;
+			field<vec>& D;
+
+			radius_func(const kdtree& T_, const mat& PY_, const double r_, field<uvec>& I_, field<vec>& D_) : T(T_), PY(PY_), r(r_), I(I_), D(D_) {}
+
+			template <typename norm_type>
+			void operator()(const norm_type& f) { T.radius_batch(f, PY, r, I, D); }
+		};
+
+		/// #knn of the packed queries PY; D and I are k-by-PY.n_cols.
+		void knn_packed(const mat& PY, const uword k, mat& D, umat& I) const
+		{
+			knn_func f(*this, PY, k, D, I);
+			dispatch(f);
+		}
+
+		/// #radius of the packed queries PY.
+		void radius_packed(const mat& PY, const double r, field<uvec>& I, field<vec>& D) const
+		{
+			I.set_size(PY.n_cols);
+			D.set_size(PY.n_cols);
+
+			radius_func f(*this, PY, r, I, D);
+			dispatch(f);
+		}
+
+		void build(const mat& X, const uword leaf_size)
+		{
+			const mat Q = metric.pack(X);
+			const uword n = Q.n_rows, m = Q.n_cols;
+
+			std::vector<uword> perm(m);
+			for (uword i = 0 ; i < m ; i++) perm[i] = i;
+
+			nodes.clear();
+			nodes.reserve(2 * (m / leaf_size) + 1);
+			const node root = { 0, m, 0 };
+			nodes.push_back(root);
+			box.clear();
+
+			// nodes are split in breadth-first order, so that the children of a node are adjacent
+			for (uword t = 0 ; t < nodes.size() ; t++) {
+				const uword begin = nodes[t].begin, end = nodes[t].end;
+
+				box.resize(box.size() + 2 * n);
+				double* lo = &box[2 * n * t];
+				double* hi = lo + n;
+				for (uword d = 0 ; d < n ; d++) {
+					lo[d] = datum::inf;
+					hi[d] = -datum::inf;
+				}
+				for (uword i = begin ; i < end ; i++) {
+					const double* q = Q.colptr(perm[i]);
+					for (uword d = 0 ; d < n ; d++) {
+						lo[d] = std::min(lo[d], q[d]);
+						hi[d] = std::max(hi[d], q[d]);
+					}
+				}
+
+				if (end - begin <= leaf_size) continue;
+
+				uword dim = 0;
+				for (uword d = 1 ; d < n ; d++)
+					if (hi[d] - lo[d] > hi[dim] - lo[dim]) dim = d;
+				if (n == 0 || !(hi[dim] > lo[dim])) continue;	// duplicates
+
+				const uword mid = begin + (end - begin) / 2;
+				std::nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end, kdtree_coord_less(Q, dim));
+
+				nodes[t].left = nodes.size();
+				const node a = { begin, mid, 0 }, b = { mid, end, 0 };
+				nodes.push_back(a);
+				nodes.push_back(b);
+			}
+
+			P.set_size(n, m);
+			index.set_size(m);
+			for (uword i = 0 ; i < m ; i++) {
+				std::copy(Q.colptr(perm[i]), Q.colptr(perm[i]) + n, P.colptr(i));
+				index[i] = perm[i];
+			}
+		}
+
+		/// Relative error of the bounds, which are accumulated in a different order than the distances.
+		static double slack() { return 1e-12; }
+
+		/// The reduced distance from the packed query q to the bounding box of the node t.
+		template <typename norm_type>
+		inline double bound(const norm_type& f, const double* q, const uword t) const
+		{
+			const uword n = P.n_rows;
+			const double* lo = &box[2 * n * t];
+			const double* hi = lo + n;
+
+			double s = 0;
+			for (uword d = 0 ; d < n ; d++) {
+				const double g = std::max(lo[d] - q[d], q[d] - hi[d]);
+				if (g > 0) s = f.add(s, g);
+			}
+			return s;
+		}
+
+		/// Finds the k nearest observations of the packed query q into the max-heap h of reduced distances.
+		template <typename norm_type>
+		void search(const norm_type& f, const double* q, const uword k, pdist2_entry* h,
+			std::vector<std::pair<double, uword> >& stack) const
+		{
+			const uword n = P.n_rows;
+			uword hs = 0;
+
+			stack.clear();
+			stack.push_back(std::make_pair(0.0, uword(0)));
+
+			while (!stack.empty()) {
+				const double b = stack.back().first;
+				const node& t = nodes[stack.back().second];
+				stack.pop_back();
+
+				if (hs == k && h[0].d < b * (1 - slack())) continue;
+
+				if (t.left == 0) {
+					for (uword i = t.begin ; i < t.end ; i++) {
+						const pdist2_entry e = { f.distance(P.colptr(i), q, n), index[i] };
+						if (hs < k) {
+							h[hs++] = e;
+							std::push_heap(h, h + hs);
+						}
+						else if (e < h[0]) {
+							std::pop_heap(h, h + k);
+							h[k - 1] = e;
+							std::push_heap(h, h + k);
+						}
+					}
+					continue;
+				}
+
+				// the nearer child is visited first
+				const double bl = bound(f, q, t.left), br = bound(f, q, t.left + 1);
+				if (bl <= br) {
+					stack.push_back(std::make_pair(br, t.left + 1));
+					stack.push_back(std::make_pair(bl, t.left));
+				}
+				else {
+					stack.push_back(std::make_pair(bl, t.left));
+					stack.push_back(std::make_pair(br, t.left + 1));
+				}
+			}
+		}
+
+		/// Finds the observations within distance r of the packed query q.
+		template <typename norm_type>
+		void search_radius(const norm_type& f, const double* q, const double r, std::vector<pdist2_entry>& out,
+			std::vector<uword>& stack) const
+		{
+			const uword n = P.n_rows;
+
+			out.clear();
+			stack.clear();
+			stack.push_back(0);
+
+			while (!stack.empty()) {
+				const node& t = nodes[stack.back()];
+				stack.pop_back();
+
+				if (t.left == 0) {
+					for (uword i = t.begin ; i < t.end ; i++) {
+						double d = f.distance(P.colptr(i), q, n);
+						if (!squared) d = f.expand(d);
+						if (d <= r) {
+							const pdist2_entry e = { d, index[i] };
+							out.push_back(e);
+						}
+					}
+					continue;
+				}
+
+				for (uword c = t.left ; c < t.left + 2 ; c++) {
+					double b = bound(f, q, c);
+					if (!squared) b = f.expand(b);
+					if (b * (1 - slack()) <= r) stack.push_back(c);
+				}
+			}
+
+			std::sort(out.begin(), out.end());
+		}
+
+		template <typename norm_type>
+		void knn_batch(const norm_type& f, const mat& PY, const uword k, mat& D, umat& I) const
+		{
+			const uword my = PY.n_cols;
+			const uword bs = 64;
+			const uword nb = (my + bs - 1) / bs;
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(b, nb, 1)
+				std::vector<pdist2_entry> heap(k);
+				std::vector<std::pair<double, uword> > stack;
+
+				for (uword j = b * bs ; j < std::min((b + 1) * bs, my) ; j++) {
+					pdist2_entry* h = &heap[0];
+					search(f, PY.colptr(j), k, h, stack);
+					std::sort_heap(h, h + k);
+
+					double* d = D.colptr(j);
+					uword* idx = I.colptr(j);
+					for (uword r = 0 ; r < k ; r++) {
+						d[r] = squared ? h[r].d : f.expand(h[r].d);
+						idx[r] = h[r].i;
+					}
+				}
+			ARMA_EXT_PARALLEL_END
+		}
+
+		template <typename norm_type>
+		void radius_batch(const norm_type& f, const mat& PY, const double r, field<uvec>& I, field<vec>& D) const
+		{
+			const uword my = PY.n_cols;
+			const uword bs = 64;
+			const uword nb = (my + bs - 1) / bs;
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(b, nb, 1)
+				std::vector<pdist2_entry> out;
+				std::vector<uword> stack;
+
+				for (uword j = b * bs ; j < std::min((b + 1) * bs, my) ; j++) {
+					search_radius(f, PY.colptr(j), r, out, stack);
+
+					uvec& idx = I(j);
+					vec& d = D(j);
+					idx.set_size(out.size());
+					d.set_size(out.size());
+					for (uword l = 0 ; l < out.size() ; l++) {
+						idx[l] = out[l].i;
+						d[l] = out[l].d;
+					}
+				}
+			ARMA_EXT_PARALLEL_END
+		}
+#endif
+	};
+
+#ifndef DOXYGEN
+	/// Pair of observations within the radius.
+	struct pdist_edge
+	{
+		uword i, j;
+		double d;
+
+		bool operator<(const pdist_edge& o) const
+		{
+			return i < o.i || (i == o.i && j < o.j);
+		}
+	};
+
+	/**
+	 *	Finds the pairs (i, j), i < j, of the packed observations P within distance r, tile by tile.
+	 *	Each block row of tiles is processed by one thread into its own buffer, which is sorted by (i, j)
+	 *	afterwards, so that the buffers are merged in order at the end.
+	 */
+	struct pdist_radius_tiles
+	{
+		template <typename eT, typename metric_type>
+		static void apply(const Mat<eT>& P, const double r, std::vector<std::vector<pdist_edge> >& rows, const metric_type& metric)
+		{
+			const uword n = P.n_rows, m = P.n_cols;
+			const uword bs = pdist_block_size(n);
+			const uword nb = (m + bs - 1) / bs;
+			rows.resize(nb);
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(I, nb, 1)
+				std::vector<pdist_edge>& out = rows[I];
+				const uword i0 = I * bs, i1 = std::min(i0 + bs, m);
+
+				for (uword j0 = i0 ; j0 < m ; j0 += bs) {
+					const uword j1 = std::min(j0 + bs, m);
+					for (uword i = i0 ; i < i1 ; i++) {
+						const eT* a = P.colptr(i);
+						for (uword j = std::max(j0, i + 1) ; j < j1 ; j++) {
+							const double d = metric(a, P.colptr(j), n);
+							if (d <= r) {
+								const pdist_edge e = { i, j, d };
+								out.push_back(e);
+							}
+						}
+					}
+				}
+
+				std::sort(out.begin(), out.end());
+			ARMA_EXT_PARALLEL_END
+		}
+	};
+#endif
+
+	/**
+	 *	@brief	Sparse graph of the pairs of observations within a distance, in compressed sparse row form.<br>
+	 *			The pairs \f$(i, j), i < j\f$ of the row \f$i\f$ are stored at [row_ptr(i), row_ptr(i + 1)),
+	 *			in increasing order of \f$j\f$. Unlike a sparse matrix, the graph keeps the pairs at distance zero.
+	 */
+	struct distance_graph
+	{
+		uword n_obs;	///< number of observations
+		uvec row_ptr;	///< offsets of the rows, \f$m + 1\f$ elements
+		uvec col;		///< the (0-based) observation \f$j\f$ of each pair
+		vec dist;		///< the distance of each pair
+	};
+
+	/**
+	 *	@brief	Pairs of observations within a distance.<br>
+	 *			Only the pairs at distances \f$\le r\f$ are kept, so the \f$m(m - 1)/2\f$ distances never reside in memory.
+	 *	@param X		The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param r		The radius.
+	 *	@param type		The distance metric.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	The graph of the pairs.
+	 *	@note	For the metrics of #kdtree, finite observations of up to 16 variables are searched with a #kdtree;
+	 *			otherwise the pairs are computed in tiles as by #pdist, in parallel, and the pairs found by each
+	 *			thread are merged at the end.
+	 */
+	inline distance_graph pdist_radius(const mat& X, double r, distance_type type = euclidean, double exponent = 2)
+	{
+		const uword m = X.n_rows;
+
+		distance_graph G;
+		G.n_obs = m;
+		G.row_ptr.zeros(m + 1);
+
+		bool tree = X.n_cols <= 16;
+		switch (type) {
+		case euclidean: case squaredeuclidean: case seuclidean: case cityblock: case minkowski:
+		case chebychev: case mahalanobis: case fasteuclidean: case fastsquaredeuclidean:
+			break;
+		default:
+			tree = false;
+			break;
+		}
+
+		if (tree && X.is_finite()) {
+			field<uvec> I;
+			field<vec> D;
+			kdtree(X, type, exponent).radius(X, r, I, D);
+
+			for (uword i = 0 ; i < m ; i++) {
+				uword c = 0;
+				for (uword l = 0 ; l < I(i).n_elem ; l++) c += (I(i)[l] > i);
+				G.row_ptr[i + 1] = G.row_ptr[i] + c;
+			}
+
+			G.col.set_size(G.row_ptr[m]);
+			G.dist.set_size(G.row_ptr[m]);
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(i, m, 64)
+				std::vector<std::pair<uword, double> > row;
+				for (uword l = 0 ; l < I(i).n_elem ; l++)
+					if (I(i)[l] > i) row.push_back(std::make_pair(I(i)[l], D(i)[l]));
+				std::sort(row.begin(), row.end());
+
+				uword o = G.row_ptr[i];
+				for (uword l = 0 ; l < row.size() ; l++, o++) {
+					G.col[o] = row[l].first;
+					G.dist[o] = row[l].second;
+				}
+			ARMA_EXT_PARALLEL_END
+			return G;
+		}
+
+		const pdist_metric metric(X, type, exponent);
+		const mat P = metric.pack(X);
+
+		std::vector<std::vector<pdist_edge> > rows;
+		pdist_dispatch<pdist_radius_tiles>(metric, P, r, rows);
+
+		uword e = 0;
+		for (uword b = 0 ; b < rows.size() ; b++) e += rows[b].size();
+		G.col.set_size(e);
+		G.dist.set_size(e);
+
+		e = 0;
+		for (uword b = 0 ; b < rows.size() ; b++) {
+			for (uword l = 0 ; l < rows[b].size() ; l++, e++) {
+				G.row_ptr[rows[b][l].i + 1]++;
+				G.col[e] = rows[b][l].j;
+				G.dist[e] = rows[b][l].d;
+			}
+			std::vector<pdist_edge>().swap(rows[b]);
+		}
+		for (uword i = 0 ; i < m ; i++) G.row_ptr[i + 1] += G.row_ptr[i];
+
+		return G;
+	}
+
+#ifndef DOXYGEN
+	/// SplitMix64 hash, which gives the random choices of independent threads from a single seed.
+	inline u64 knngraph_hash(u64 x)
+	{
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	/// Neighbor of an observation, ordered by distance and then by index; @c fresh marks the neighbors not joined yet.
+	struct knngraph_entry
+	{
+		double d;
+		uword i;
+		bool fresh;
+
+		bool operator<(const knngraph_entry& o) const
+		{
+			return d < o.d || (d == o.d && i < o.i);
+		}
+	};
+
+	/// Update of the neighbors of the observation t by the observation u at distance d.
+	struct knngraph_update
+	{
+		uword t, u;
+		double d;
+	};
+
+	/// Inserts u at distance d into the max-heap h of k neighbors, if it is nearer than the farthest and not yet in h.
+	inline bool knngraph_push(knngraph_entry* h, const uword k, const uword u, const double d)
+	{
+		const knngraph_entry e = { d, u, true };
+		if (!(e < h[0])) return false;
+		for (uword l = 0 ; l < k ; l++)
+			if (h[l].i == u) return false;
+
+		std::pop_heap(h, h + k);
+		h[k - 1] = e;
+		std::push_heap(h, h + k);
+		return true;
+	}
+
+	/// Inserts u with the random priority p into the bounded max-heap h of c <= L candidates, if not yet in h.
+	inline void knngraph_sample(std::pair<double, uword>* h, uword& c, const uword L, const double p, const uword u)
+	{
+		for (uword l = 0 ; l < c ; l++)
+			if (h[l].second == u) return;
+
+		if (c < L) {
+			h[c++] = std::make_pair(p, u);
+			std::push_heap(h, h + c);
+		}
+		else if (p < h[0].first) {
+			std::pop_heap(h, h + L);
+			h[L - 1] = std::make_pair(p, u);
+			std::push_heap(h, h + L);
+		}
+	}
+
+	/**
+	 *	Builds the k-nearest neighbor graph of the packed observations P by NN-descent (Dong et al., 2011):
+	 *	starting from random neighbors, the neighbors of the neighbors of each observation are compared with
+	 *	each other, by the local join, until few neighbors change. H holds a max-heap of k neighbors per observation.
+	 *
+	 *	Each iteration samples up to L = sample * k new and old candidates per observation, among its neighbors
+	 *	and reverse neighbors, by random priorities. The local joins of a batch of observations are computed
+	 *	in parallel, and each thread keeps the distances that improve a heap in its own buffers, one per range
+	 *	of observations. The heaps of each range are then updated by a single thread, so that the heaps are
+	 *	read-only during the joins and no heap is shared by threads.
+	 */
+	struct knngraph_descent
+	{
+		template <typename metric_type>
+		static void apply(const mat& P, const uword k, const double sample, const double delta, const uword max_iter,
+			const u64 seed, std::vector<knngraph_entry>& H, const metric_type& metric)
+		{
+			const uword n = P.n_rows, m = P.n_cols;
+			const uword L = std::max<uword>((uword)(sample * k + 0.5), 1);
+			const uword nc = 64, np = 64;	// chunks of a batch, and ranges of observations
+			const uword batch = std::max<uword>((1 << 20) / (L * L), nc);
+
+			H.resize(m * k);
+
+			// random initial neighbors
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(i, m, 64)
+				knngraph_entry* h = &H[i * k];
+				u64 state = knngraph_hash(seed ^ (u64)i);
+				for (uword l = 0 ; l < k ; ) {
+					state = knngraph_hash(state);
+					uword j = (uword)(state % (u64)(m - 1));
+					if (j >= i) j++;
+
+					bool dup = false;
+					for (uword q = 0 ; q < l && !dup ; q++) dup = (h[q].i == j);
+					if (dup) continue;
+
+					const double d = metric(P.colptr(i), P.colptr(j), n);
+					h[l].d = (d != d) ? datum::inf : d;
+					h[l].i = j;
+					h[l].fresh = true;
+					l++;
+				}
+				std::make_heap(h, h + k);
+			ARMA_EXT_PARALLEL_END
+
+			std::vector<std::pair<double, uword> > fresh(m * L), old(m * L);
+			std::vector<uword> nfresh(m), nold(m);
+			std::vector<std::vector<knngraph_update> > buf(nc * np);
+			std::vector<uword> changed(np);
+
+			for (uword iter = 0 ; iter < max_iter ; iter++) {
+				// sample the candidates, among the neighbors and the reverse neighbors
+				std::fill(nfresh.begin(), nfresh.end(), uword(0));
+				std::fill(nold.begin(), nold.end(), uword(0));
+				for (uword i = 0 ; i < m ; i++) {
+					const knngraph_entry* h = &H[i * k];
+					for (uword l = 0 ; l < k ; l++) {
+						const uword j = h[l].i;
+						const u64 key = seed + (u64)iter * 0x632BE59BD9B4E019ULL + (u64)std::min(i, j) * (u64)m + std::max(i, j);
+						const double p = (knngraph_hash(key) >> 11) * (1.0 / 9007199254740992.0);
+						if (h[l].fresh) {
+							knngraph_sample(&fresh[i * L], nfresh[i], L, p, j);
+							knngraph_sample(&fresh[j * L], nfresh[j], L, p, i);
+						}
+						else {
+							knngraph_sample(&old[i * L], nold[i], L, p, j);
+							knngraph_sample(&old[j * L], nold[j], L, p, i);
+						}
+					}
+				}
+
+				// the sampled neighbors are joined only once
+				ARMA_EXT_PARALLEL_FOR(i, m)
+					knngraph_entry* h = &H[i * k];
+					const std::pair<double, uword>* f = &fresh[i * L];
+					for (uword l = 0 ; l < k ; l++) {
+						if (!h[l].fresh) continue;
+						for (uword q = 0 ; q < nfresh[i] ; q++)
+							if (f[q].second == h[l].i) { h[l].fresh = false; break; }
+					}
+				ARMA_EXT_PARALLEL_END
+
+				uword total = 0;
+				for (uword b0 = 0 ; b0 < m ; b0 += batch) {
+					const uword b1 = std::min(b0 + batch, m), cs = (b1 - b0 + nc - 1) / nc;
+
+					// local joins, with the heaps read-only
+					ARMA_EXT_PARALLEL_FOR_DYNAMIC(c, nc, 1)
+						std::vector<knngraph_update>* out = &buf[c * np];
+						for (uword r = 0 ; r < np ; r++) out[r].clear();
+
+						const uword v1 = std::min(b0 + (c + 1) * cs, b1);
+						for (uword v = b0 + c * cs ; v < v1 ; v++) {
+							const std::pair<double, uword>* f = &fresh[v * L];
+							const std::pair<double, uword>* o = &old[v * L];
+							for (uword x = 0 ; x < nfresh[v] ; x++) {
+								const uword a = f[x].second;
+								const double wa = H[a * k].d;
+								for (uword y = x + 1 ; y < nfresh[v] + nold[v] ; y++) {
+									const uword b = (y < nfresh[v]) ? f[y].second : o[y - nfresh[v]].second;
+									if (a == b) continue;
+
+									double d = metric(P.colptr(a), P.colptr(b), n);
+									if (d != d) d = datum::inf;
+									if (d < wa || (d == wa && b < H[a * k].i)) {
+										const knngraph_update e = { a, b, d };
+										out[a * np / m].push_back(e);
+									}
+									if (d < H[b * k].d || (d == H[b * k].d && a < H[b * k].i)) {
+										const knngraph_update e = { b, a, d };
+										out[b * np / m].push_back(e);
+									}
+								}
+							}
+						}
+					ARMA_EXT_PARALLEL_END
+
+					// each range of heaps is updated by a single thread
+					ARMA_EXT_PARALLEL_FOR_DYNAMIC(r, np, 1)
+						uword count = 0;
+						for (uword c = 0 ; c < nc ; c++) {
+							const std::vector<knngraph_update>& in = buf[c * np + r];
+							for (uword l = 0 ; l < in.size() ; l++)
+								count += knngraph_push(&H[in[l].t * k], k, in[l].u, in[l].d);
+						}
+						changed[r] = count;
+					ARMA_EXT_PARALLEL_END
+					for (uword r = 0 ; r < np ; r++) total += changed[r];
+				}
+
+				if (total <= delta * k * m) break;
+			}
+		}
+	};
+#endif
+
+	/**
+	 *	@brief	Options of #knngraph.<br>
+	 *			The sample rate and the number of iterations trade the recall of the graph for speed: fewer candidates
+	 *			take fewer distances per iteration, but miss more neighbors.
+	 */
+	struct knngraph_options
+	{
+		distance_type distance;	///< the distance metric
+		double exponent;		///< the exponent of the Minkowski distance
+		double sample;			///< the number of candidates joined per observation and iteration, as a multiple of k
+		double delta;			///< the iterations stop when fewer than delta * k * m neighbors change
+		uword max_iter;			///< the maximum number of iterations
+
+		knngraph_options() : distance(euclidean), exponent(2), sample(2), delta(0.001), max_iter(20) {}
+	};
+
+	/**
+	 *	@brief	Approximate k nearest neighbors of each observation, by NN-descent.<br>
+	 *			Starting from random neighbors, the neighbors of the neighbors of each observation are compared with
+	 *			each other until few neighbors change, in about \f$O(m^{1.14})\f$ distances for \f$m\f$ observations,
+	 *			instead of the \f$m(m - 1)/2\f$ distances of #pdist. The random choices follow the random number
+	 *			generator of Armadillo, so the graph is reproducible with @c arma_rng::set_seed.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param k	The number of neighbors, other than the observation itself. At most \f$m - 1\f$ are returned.
+	 *	@param I	The indices of the neighbors: I(r, j) is the (0-based) row of X of the r-th nearest neighbor of the row j.
+	 *	@param opts	The options.
+	 *	@return	The \f$k\f$-by-\f$m\f$ matrix of the distances in ascending order; ties are ordered by index.
+	 *			The distances involving NaN are infinite.
+	 *	@see	kdtree::knn for the exact neighbors of low-dimensional observations.
+	 */
+	inline mat knngraph(const mat& X, uword k, umat& I, const knngraph_options& opts = knngraph_options())
+	{
+		if (!(opts.sample > 0))
+			throw std::invalid_argument("The sample rate must be positive.");
+
+		const uword m = X.n_rows;
+		k = (m > 1) ? std::min(k, m - 1) : 0;
+
+		mat D(k, m);
+		I.set_size(k, m);
+		if (k == 0) return D;
+
+		const vec u = randu<vec>(1);
+		const u64 seed = (u64)(u[0] * 9007199254740992.0);
+
+		const pdist_metric metric(X, opts.distance, opts.exponent);
+		const mat P = metric.pack(X);
+
+		std::vector<knngraph_entry> H;
+		pdist_dispatch<knngraph_descent>(metric, P, k, opts.sample, opts.delta, opts.max_iter, seed, H);
+
+		for (uword j = 0 ; j < m ; j++) {
+			knngraph_entry* h = &H[j * k];
+			std::sort_heap(h, h + k);
+			for (uword r = 0 ; r < k ; r++) {
+				D.at(r, j) = h[r].d;
+				I.at(r, j) = h[r].i;
+			}
+		}
+
+		return D;
+	}
+
+	/**
+	 *	@brief	Approximate k-nearest neighbor graph, by NN-descent.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param k	The number of neighbors of each observation.
+	 *	@param opts	The options.
+	 *	@return	The \f$m\f$-by-\f$m\f$ sparse matrix G of the distances, where G(i, j) is the distance of the row j of X
+	 *			to its neighbor i. Each column holds the neighbors of an observation in compressed form, which is the
+	 *			compressed sparse row form of the graph. As in any sparse matrix, the neighbors at distance zero are not stored.
+	 *	@see	knngraph(const mat&, uword, umat&, const knngraph_options&)
+	 */
+	inline sp_mat knngraph(const mat& X, uword k, const knngraph_options& opts = knngraph_options())
+	{
+		umat I;
+		const mat D = knngraph(X, k, I, opts);
+		const uword m = X.n_rows;
+		k = D.n_rows;
+
+		umat loc(2, k * m);
+		vec val(k * m);
+		for (uword j = 0 ; j < m ; j++) {
+			std::vector<std::pair<uword, double> > col(k);
+			for (uword r = 0 ; r < k ; r++) col[r] = std::make_pair(I.at(r, j), D.at(r, j));
+			std::sort(col.begin(), col.end());
+
+			for (uword r = 0 ; r < k ; r++) {
+				loc.at(0, j * k + r) = col[r].first;
+				loc.at(1, j * k + r) = j;
+				val[j * k + r] = col[r].second;
+			}
+		}
+
+		return sp_mat(loc, val, m, m);
+	}
+
+	/**
+	 *	@brief	Buffers of #linkage, kept across calls.<br>
+	 *			Clustering many small sets of observations with the same workspace avoids allocating the
+	 *			buffers, and the copy of the distances, in every call. A workspace must not be shared by
+	 *			concurrent calls.
+	 */
+	class linkage_workspace
+	{
+	public:
+		linkage_workspace() {}
+
+		/// Reserves the buffers for m observations.
+		void reserve(const uword m)
+		{
+			y.reserve(m * (m - 1) / 2 + 1);
+			T.reserve(512); K.reserve(512); L.reserve(512); block.reserve(m / 4096 + 1);
+			obp.reserve(m); scl.reserve(m);
+			height.reserve(m); key.reserve(m); level.reserve(m);
+			chain.reserve(m); left.reserve(m); right.reserve(m); size.reserve(m);
+			order.reserve(m); parent.reserve(m); node.reserve(m);
+			active.reserve(m);
+		}
+
+#ifndef DOXYGEN
+		std::vector<double> y;		// copy of the distances
+		std::vector<double> T;		// linkagemex: the smallest distances
+		std::vector<double> block;	// linkagemex: the smallest new distance of each block
+		std::vector<std::ptrdiff_t> K, L, obp, scl;
+		std::vector<double> height, key, level;
+		std::vector<uword> chain, left, right, size;
+		std::vector<uword> order, parent, node;	// linkage_tree
+		std::vector<char> active;
+#endif
+	};
+
+#ifndef DOXYGEN
+	/**
+	 *	Computes h[r], the largest height of the merge r and of all the merges below it, so that the merge r
+	 *	is not cut at c if h[r] <= c. The children of a merge are formed at earlier rows, so a single pass from
+	 *	the leaves up suffices. A NaN height, of the merge or of a merge below it, is kept, so that the merge is always cut.
+	 */
+	inline void cluster_heights(const mat& Z, std::vector<double>& h)
+	{
+		const uword n = Z.n_rows, m = n + 1;
+		h.resize(n);
+
+		for (uword r = 0 ; r < n ; r++) {
+			double t = Z.at(r, 2);
+			for (uword j = 0 ; j < 2 && t == t ; j++) {
+				const uword child = (uword)Z.at(r, j);
+				if (child > m && !(h[child - m - 1] <= t)) t = h[child - m - 1];	// also propagates NaN
+			}
+			h[r] = t;
+		}
+	}
+
+	/**
+	 *	Labels the observations by the subtrees of Z that are not cut, as marked by conn.
+	 *	Each side of a cut merge r starts a cluster, which is passed down through the connected merges from the
+	 *	root. The cluster is keyed r + 1 on the left and n + r + 1 on the right, or 2r + 1 and 2r + 2 if
+	 *	@c interleave is set, and the keys are numbered \f$1, \cdots, k\f$ in increasing order, which is the
+	 *	numbering of the MATLAB implementation for the distance and maxclust criteria, respectively.
+	 *	T has n + 1 elements, and key has 2n + 1 elements.
+	 */
+	inline void cluster_labels(const mat& Z, const std::vector<char>& conn, uword* T, uword* key, const bool interleave = false)
+	{
+		const uword n = Z.n_rows, m = n + 1;
+
+		// the whole tree is a single cluster
+		if (n == 0 || conn[n - 1]) {
+			std::fill(T, T + m, uword(1));
+			return;
+		}
+
+		// node[r] is the cluster of the merge r, which is passed down to its children
+		uword* node = key + m;	// uses key[m, 2n] before key[1, 2n] is used to relabel
+		for (uword r = n ; r-- > 0 ; ) {
+			for (uword j = 0 ; j < 2 ; j++) {
+				const uword child = (uword)Z.at(r, j);
+				const uword k = conn[r] ? node[r] : (interleave ? 2 * r + j + 1 : r + 1 + j * n);
+				if (child <= m) T[child - 1] = k;
+				else node[child - m - 1] = k;
+			}
+		}
+
+		// number the keys in increasing order
+		std::fill(key, key + 2 * n + 1, uword(0));
+		for (uword i = 0 ; i < m ; i++) key[T[i]] = 1;
+		for (uword k = 1, label = 0 ; k <= 2 * n ; k++)
+			if (key[k]) key[k] = ++label;
+		for (uword i = 0 ; i < m ; i++) T[i] = key[T[i]];
+	}
+
+	/// Labels the observations by the k clusters of the maxclust criterion; the merges from the row n - k + 1 are cut.
+	inline void cluster_maxclust(const mat& Z, const uword k, uword* T, std::vector<char>& conn, uword* key)
+	{
+		const uword n = Z.n_rows, m = n + 1;
+
+		if (k == 0)
+			throw std::invalid_argument("The maximum number of clusters must be positive.");
+
+		if (k >= m) {
+			for (uword i = 0 ; i < m ; i++) T[i] = i + 1;
+			return;
+		}
+
+		conn.resize(n);
+		for (uword r = 0 ; r < n ; r++) conn[r] = (r + k < m);
+		cluster_labels(Z, conn, T, key, true);
+	}
+
+	/// Entry of the smallest distances of linkagemex, ordered by value and then by the later position in the scan.
+	struct linkagemex_entry
+	{
+		double t;
+		std::ptrdiff_t k, l, pos;
+
+		bool operator<(const linkagemex_entry& o) const
+		{
+			return t < o.t || (t == o.t && pos > o.pos);
+		}
+	};
+
+	/**
+	 *	Parallel rescan of linkagemex: finds the N smallest distances among the clusters bc, ..., m - 1,
+	 *	and returns how many were found, that is, the number of distances which are not NaN, up to N.
+	 *	The rows are split into blocks of equal number of distances, each block keeps its own N smallest
+	 *	distances, and the lists are merged by the same order as the serial scan, so that the entries
+	 *	are identical to the serial result.
+	 */
+	inline std::ptrdiff_t linkagemex_rescan(const double* y, const std::ptrdiff_t m, const std::ptrdiff_t bc,
+		const std::ptrdiff_t N, double* T, std::ptrdiff_t* K, std::ptrdiff_t* L)
+	{
+		typedef std::ptrdiff_t mwSize;
+
+		const condensed_distance<double> D(const_cast<double*>(y), (uword)m);
+		const mwSize rem = (m - bc) * (m - bc - 1) / 2;
+		const mwSize nb = std::max<mwSize>(1, std::min<mwSize>(rem / 65536, 256));
+
+		// block b scans the rows [rows[b], rows[b + 1])
+		std::vector<mwSize> rows(nb + 1, m);
+		rows[0] = bc;
+		for (mwSize j = bc, b = 1, acc = 0 ; j < m && b < nb ; j++) {
+			acc += m - 1 - j;
+			if (acc * nb >= b * rem) rows[b++] = j + 1;
+		}
+
+		std::vector<std::vector<linkagemex_entry> > top(nb);
+		std::vector<mwSize> count(nb, 0);
+
+		ARMA_EXT_PARALLEL_FOR_DYNAMIC(ub, nb, 1)
+			const mwSize b = (mwSize)ub;
+			std::vector<linkagemex_entry>& list = top[b];
+			list.reserve(N + 1);
+
+			for (mwSize j = rows[b] ; j < rows[b + 1] ; j++) {
+				mwSize p = (mwSize)D.offset((uword)j, (uword)j + 1);
+				for (mwSize i = j + 1 ; i < m ; i++, p++) {
+					const double t2 = y[p];
+					if (t2 != t2) continue;
+					count[b]++;
+
+					linkagemex_entry e = { t2, j, i, p };
+					if ((mwSize)list.size() == N) {
+						if (!(e < list.back())) continue;
+						list.pop_back();
+					}
+					list.insert(std::upper_bound(list.begin(), list.end(), e), e);
+				}
+			}
+		ARMA_EXT_PARALLEL_END
+
+		std::vector<linkagemex_entry> all;
+		mwSize total = 0;
+		for (mwSize b = 0 ; b < nb ; b++) {
+			all.insert(all.end(), top[b].begin(), top[b].end());
+			total += count[b];
+		}
+
+		const mwSize sT = std::min(N, (mwSize)all.size());
+		std::partial_sort(all.begin(), all.begin() + sT, all.end());
+
+		for (mwSize h = 0 ; h < N ; h++) T[h] = datum::inf;
+		for (mwSize h = 0 ; h < sT ; h++) {
+			T[h] = all[h].t;
+			K[h] = all[h].k;
+			L[h] = all[h].l;
+		}
+
+		return std::min(N, total);
+	}
+
+	/**
+	 *	Parallel update of linkagemex: merges the clusters k and l (bc <= k < l) into l, that is, replaces the
+	 *	distance between l and every other cluster g = bc, ..., m - 1 by the distance to the merged cluster,
+	 *	and returns the smallest new distance.
+	 *	The blocks of clusters are updated in parallel, and the minimums of the blocks are reduced in order.
+	 *	The arguments are the cluster sizes and the constants of the serial update.
+	 */
+	inline double linkagemex_update(const linkage_method method, double* y, const std::ptrdiff_t m, const std::ptrdiff_t bc,
+		const std::ptrdiff_t k, const std::ptrdiff_t l, const std::ptrdiff_t* scl, const std::ptrdiff_t nk, const std::ptrdiff_t nl,
+		const double t1, const double rnk, const double rnl, std::vector<double>& block)
+	{
+		typedef std::ptrdiff_t mwSize;
+
+		const condensed_distance<double> D(y, (uword)m);
+		const mwSize bs = 4096;
+		const mwSize nb = (m - bc + bs - 1) / bs;
+		block.assign(nb, datum::inf);
+
+		ARMA_EXT_PARALLEL_FOR(ub, nb)
+			const mwSize b = (mwSize)ub;
+			double t3 = datum::inf;
+			const mwSize g1 = std::min(m, bc + (b + 1) * bs);
+
+			for (mwSize g = bc + b * bs ; g < g1 ; g++) {
+				if (g == k || g == l) continue;
+
+				const double a = y[g < k ? D.offset((uword)g, (uword)k) : D.offset((uword)k, (uword)g)];
+				double& yl = y[g < l ? D.offset((uword)g, (uword)l) : D.offset((uword)l, (uword)g)];
+				double t2;
+
+				switch (method) {
+				case single_linkage:
+					t2 = (a < yl || yl != yl) ? a : yl;
+					break;
+				case complete_linkage:
+					t2 = (a > yl || yl != yl) ? a : yl;
+					break;
+				case average_linkage:
+					t2 = a * rnk + yl * rnl;
+					break;
+				case weighted_linkage:
+					t2 = (a + yl)/2;
+					break;
+				case centroid_linkage:
+					t2 = a * rnk + yl * rnl - t1;
+					break;
+				case median_linkage:
+					t2 = (a + yl)/2 - t1;
+					break;
+				default:	// ward_linkage
+					{
+						const mwSize ng = scl[g];
+						t2 = (a*(nk+ng) + yl*(nl+ng) - t1*ng) / (nk+nl+ng);
+					}
+					break;
+				}
+
+				yl = t2;
+				if (t2 < t3) t3 = t2;
+			}
+
+			block[b] = t3;
+		ARMA_EXT_PARALLEL_END
+
+		double t3 = datum::inf;
+		for (mwSize b = 0 ; b < nb ; b++)
+			if (block[b] < t3) t3 = block[b];
+		return t3;
+	}
+
+	/**
+	 *	@note	This function taken from linkagemex.cpp, and partially adopted.
+	 *			This function could have copyright problem.
+	 *			If @c work is given, the merges are computed in it instead of a copy of the distances.
+	 *	@copyright 2003-2006 The MathWorks, Inc.
+	 */
+	template <typename eT>
+	mat linkagemex(const condensed_distance<eT>& Y, linkage_method method, double* work, linkage_workspace& ws)
+	{
+		#define ISNAN_(a) (a != a)
+
+		linkage_method method_key;
+
+		typedef std::ptrdiff_t mwSize;	/* 64-bit offsets for large condensed vectors */
+		typedef double TEMPL;
+
+		static TEMPL  inf;
+		mwSize        m,n,i,j,bn,bc,bp,p1,p2,q,q1,q2,h,k,l,g;
+		mwSize        nk = 0,nl = 0,ng,nkpnl,sT,N;
+		mwSize        *obp,*scl = nullptr,*K,*L;
+		TEMPL         *y,*s,*b1,*b2,*T;
+		const eT      *yi;
+		TEMPL         t1,t2,t3,rnk = 0,rnl = 0;
+		int           uses_scl = false,  no_squared_input = true;
+
+		/* large problems update the distances and rescan them in parallel */
+#if defined(USE_PPL) || defined(USE_OPENMP)
+		const bool    parallel = true;
+#else
+		const bool    parallel = false;
+#endif
+
+		/* get the method */
+		method_key = method;
+		no_squared_input = !(method_key == ward_linkage || method_key == centroid_linkage || method_key == median_linkage);
+
+		/* get the dimensions of inputs */
+		n = (mwSize)Y.size();	/* number of pairwise distances --> n */
+		m = (mwSize)Y.n_obs();	/* size of distance matrix --> m */
+
+		/*  create a pointer to the input pairwise distances */
+		yi = Y.memptr();
+
+		/* set space to copy the input */
+		if (!work) {
+			ws.y.resize(n + 1);
+			work = &ws.y[0];
+		}
+		y = work;
+
+		/* copy input and compute Y^2 if necessary.  lots of books use 0.5*Y^2
+		* for ward's, but the 1/2 makes no difference */
+		if (no_squared_input) { if ((const void*)y != (const void*)yi) std::copy(yi, yi + n, y); }
+		else /* then it is ward's, centroid, or median */
+			for (i=0; i<n; i++) y[i] = (TEMPL)yi[i] * yi[i];
+
+		/* calculate some other constants */
+		bn   = m-1;                        /* number of branches     --> bn */
+
+		inf = arma::datum::inf;
+
+		/*  allocate space for the output matrix  */
+		mat out(bn, 3);
+		b1 = out.memptr();	/*leftmost  column */
+		b2 = b1 + bn;		/*center    column */
+		s = b2 + bn;		/*rightmost column */
+
+		/* find the best value for N (size of the temporal vector of  */
+		/* minimums) depending on the problem size */
+		if      (m>1023) N = 512;
+		else if (m>511)  N = 256;
+		else if (m>255)  N = 128;
+		else if (m>127)  N = 64;
+		else if (m>63)   N = 32;
+		else             N = 16;
+
+		if (method_key == single_linkage) N = N >> 2;
+
+		/* set space for the vector of minimums (and indexes) */
+		ws.T.resize(N); T = &ws.T[0];
+		ws.K.resize(N); K = &ws.K[0];
+		ws.L.resize(N); L = &ws.L[0];
+
+		/* set space for the obs-branch pointers  */
+		ws.obp.resize(m + 1); obp = &ws.obp[0];
+
+		switch (method_key) {
+		case average_linkage:
+		case centroid_linkage:
+		case ward_linkage:
+			uses_scl = true;
+			/* set space for the size of clusters vector */
+			ws.scl.resize(m + 1); scl = &ws.scl[0];
+			/* initialize obp and scl */
+			for (i=0; i<m; obp[i]=i, scl[i++]=1);
+			break;
+		default: /*all other cases */
+			/* only initialize obp */
+			for (i=0; i<m; i++) obp[i]=i;
+		} /* switch (method_key) */
+
+		sT = 0;  t3 = inf;
+
+		for (bc=0,bp=m;bc<bn;bc++,bp++){
+			/* *** MAIN LOOP ***
+			bc is a "branch counter" --> bc = [ 0:bn-1]
+			bp is a "branch pointer" --> bp = [ m:m+bc-1 ], it is used to point
+			branches in the output since the values [0:m-1]+1 are reserved for
+			leaves.
+			*/
+
+			/*
+			find the "k","l" indices of the minimum distance "t1" in the remaining
+			half matrix, the new computed distances to the new cluster will be placed
+			in the row/col "l", then the leftmost column in the matrix of pairwise
+			distances will be moved to the row/col "k", so the whole matrix of
+			distances is smaller at every step */
+
+			/*  OLD METHOD: search for the minimun in the whole "y" at every branch
+			iteration
+			t1 = inf;
+			p1 = ((m2m1 - bc) * bc) >> 1; // finds where the remaining matrix starts
+			for (j=bc; j<m; j++) {
+			for (i=j+1; i<m; i++) {
+			t2 = y[p1++];
+			if (t2<t1) { k=j, l=i, t1=t2;}
+			}
+			}
+			*/
+
+			/*  NEW METHOD: Keeps a sorted vector "T" with the N minimum distances,
+			at every branch iteration we only pick the first entry. Now the whole
+			"y" is not searched at every step, we will search it again only when
+			all the entries in "T" have been used or invalidated. However, we need
+			to keep track of invalid distances already sorted in "y", and also
+			update the index vectors "K" and "L" with permutations occurred in the
+			half matrix "y"
+			*/
+
+			/* cuts "T" so it does not contain any distance greater than any of the
+			new distances computed when joined the last clusters ("t3" contains
+			the minimum new distance computed in the last iteration). */
+			for (h=0;((T[h]<t3) && (h<sT));h++);
+			sT = h; t3 = inf;
+			/* ONLY when "T" is empty it searches again "y" for the N minimum
+			distances  */
+			if (sT==0 && parallel && (m-bc)*(m-bc-1)/2 >= ((mwSize)1 << 17))
+				sT = linkagemex_rescan(y, m, bc, N, T, K, L);
+			else if (sT==0) {
+				for (h=0; h<N; T[h++]=inf);
+				p1 = (mwSize)Y.offset(bc, bc + 1); /* finds where the matrix starts */
+				for (j=bc; j<m; j++) {
+					for (i=j+1; i<m; i++) {
+						t2 = y[p1++];
+						/*  this would be needed to solve NaN bug in MSVC*/
+						/*  if (!mxIsNaN(t2)) { */
+						if (t2 <= T[N-1]) {
+							for (h=N-1; ((h>0) && (t2 <= T[h-1])); h--) {
+								T[h]=T[h-1];
+								K[h]=K[h-1];
+								L[h]=L[h-1];
+							} /* for (h=N-1 ... */
+							T[h] = t2;
+							K[h] = j;
+							L[h] = i;
+							sT++;
+						} /* if (t2<T[N-1]) */
+						/*}*/
+					} /*  for (i= ... */
+				} /* for (j= ... */
+				if (sT>N) sT=N;
+			} /* if (sT<1) */
+
+			/* if sT==0 but bc<bn then the remaining distances in "T" must be
+			NaN's ! we break the loop, but still need to fill the remaining
+			output rows with linkage info and NaN distances
+			*/
+			if (sT==0) break;
+
+
+			/* the first entry in the ordered vector of distances "T" is the one
+			that will be used for this branch, "k" and "l" are its indexes */
+			k=K[0]; l=L[0]; t1=T[0];
+
+			/* some housekeeping over "T" to inactivate all the other minimum
+			distances which also have a "k" or "l" index, and then also take
+			care of those indexes of the distances which are in the leftmost
+			column */
+			for (h=0,i=1;i<sT;i++) {
+				/* test if the other entries of "T" belong to the branch "k" or "l"
+				if it is true, do not move them in to the updated "T" because
 				these distances will be recomputed after merging the clusters */
 				if ( (k!=K[i]) && (l!=L[i]) && (l!=K[i]) && (k!=L[i]) ) {
 					T[h]=T[i];
@@ -446,375 +2815,3216 @@ namespace arma_ext
 			} /* for (h=0 ... */
 			sT=h; /* the new size of "T" after the shifting */
 
-			/* Update output for this branch, puts smaller pointers always in the
-			leftmost column */
-			if (obp[k]<obp[l]) {
-				*b1++ = (TEMPL) (obp[k]+1); /* +1 since Matlab ptrs start at 1 */
-				*b2++ = (TEMPL) (obp[l]+1);
-			} else {
-				*b1++ = (TEMPL) (obp[l]+1);
-				*b2++ = (TEMPL) (obp[k]+1);
+			/* Update output for this branch, puts smaller pointers always in the
+			leftmost column */
+			if (obp[k]<obp[l]) {
+				*b1++ = (TEMPL) (obp[k]+1); /* +1 since Matlab ptrs start at 1 */
+				*b2++ = (TEMPL) (obp[l]+1);
+			} else {
+				*b1++ = (TEMPL) (obp[l]+1);
+				*b2++ = (TEMPL) (obp[k]+1);
+			}
+			*s++ = (no_squared_input) ? t1 : sqrt(t1);
+
+			/* Updates obs-branch pointers "obp" */
+			obp[k] = obp[bc];        /* new cluster branch ptr */
+			obp[l] = bp;             /* leftmost column cluster branch ptr */
+
+			/*
+			Merges two observations/clusters ("k" and "l") by re-calculating new
+			distances for every remaining observation/cluster and place the
+			information in the row/col "l" */
+
+			/*
+
+			example:  bc=2  k=5  l=8   bn=11   m=12
+
+			0
+			1    N                             Pairwise
+			2    N   N                         Distance
+			3    N   N   Y                     Half Matrix
+			4    N   N   Y   Y
+			5    N   N  p1*  *   *
+			6    N   N   Y   Y   Y   +
+			7    N   N   Y   Y   Y   +   Y
+			8    N   N  p2*  *   *   []  +   +
+			9    N   N   Y   Y   Y   o   Y   Y   o
+			10   N   N   Y   Y   Y   o   Y   Y   o   Y
+			11   N   N   Y   Y   Y   o   Y   Y   o   Y   Y
+
+			0   1   2   3   4   5   6   7   8   9   10   11
+
+
+			p1 is the initial pointer for the kth row-col
+			p2 is the initial pointer for the lth row-col
+			*  are the samples touched in the first loop
+			+  are the samples touched in the second loop
+			o  are the samples touched in the third loop
+			N  is the part of the whole half matrix which is no longer used
+			Y  are all the other samples (not touched)
+
+			*/
+
+			/* computing some limit constants to set up the 3-loops to
+			transverse Y */
+			q1 = bn - k - 1;
+			q2 = bn - l - 1;
+
+			/* initial pointers to the "k" and  "l" entries in the remaining half
+			matrix */
+			p1 = (mwSize)Y.offset(bc, k);
+			p2 = p1 - k + l;
+
+			if (uses_scl) {
+				/* Get the cluster cardinalities  */
+				nk     = scl[k];
+				nl     = scl[l];
+				nkpnl  = nk + nl;
+
+				/* Updates cluster cardinality "scl" */
+				scl[k] = scl[bc];        /* letfmost column cluster cardinality */
+				scl[l] = nkpnl;          /* new cluster cardinality */
+
+			} /* if (uses_scl) */
+
+			/* some other values that we want to compute outside the loops */
+			switch (method_key) {
+			case centroid_linkage:
+				t1 = t1 * ((TEMPL) nk * (TEMPL) nl) / ((TEMPL) nkpnl * (TEMPL) nkpnl);
+				// the centroid update also needs the weighting ratios
+				// fall through
+			case average_linkage:
+				/* Computes weighting ratios */
+				rnk = (TEMPL) nk / (TEMPL) nkpnl;
+				rnl = (TEMPL) nl / (TEMPL) nkpnl;
+				break;
+			case median_linkage:
+				t1 = t1/4;
+                break;
+            default:
+                break;
+			} /* switch (method_key) */
+
+			if (parallel && m-bc >= 8192)
+				t3 = linkagemex_update(method_key, y, m, bc, k, l, scl, nk, nl, t1, rnk, rnl, ws.block);
+			else switch (method_key) {
+			case average_linkage:
+				for (q=bn-bc-1; q>q1; q--) {
+					t2 = y[p1] * rnk + y[p2] * rnl;
+					if (t2 < t3) t3 = t2 ;
+					y[p2] = t2;
+					p1 = p1 + q;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2 = p2 + q;
+				for (q=q1-1;  q>q2; q--) {
+					t2 = y[p1] * rnk + y[p2] * rnl;
+					if (t2 < t3) t3 = t2 ;
+					y[p2] = t2;
+					p1++;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2++;
+				for (q=q2+1; q>0; q--) {
+					t2 = y[p1] * rnk + y[p2] * rnl;
+					if (t2 < t3) t3 = t2 ;
+					y[p2] = t2;
+					p1++;
+					p2++;
+				}
+				break; /* case average_linkage */
+
+			case single_linkage:
+				for (q=bn-bc-1; q>q1; q--) {
+					if (y[p1] < y[p2]) y[p2] = y[p1];
+					else if (ISNAN_(y[p2])) y[p2] = y[p1];
+					if (y[p2] < t3)    t3 = y[p2];
+					p1 = p1 + q;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2 = p2 + q;
+				for (q=q1-1;  q>q2; q--) {
+					if (y[p1] < y[p2]) y[p2] = y[p1];
+					else if (ISNAN_(y[p2])) y[p2] = y[p1];
+					if (y[p2] < t3)    t3 = y[p2];
+					p1++;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2++;
+				for (q=q2+1; q>0; q--) {
+					if (y[p1] < y[p2]) y[p2] = y[p1];
+					else if (ISNAN_(y[p2])) y[p2] = y[p1];
+					if (y[p2] < t3)    t3 = y[p2];
+					p1++;
+					p2++;
+				}
+				break; /* case simple */
+
+			case complete_linkage:
+				for (q=bn-bc-1; q>q1; q--) {
+					if (y[p1] > y[p2]) y[p2] = y[p1];
+					else if (ISNAN_(y[p2])) y[p2] = y[p1];
+					if (y[p2] < t3)    t3 = y[p2];
+					p1 = p1 + q;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2 = p2 + q;
+				for (q=q1-1;  q>q2; q--) {
+					if (y[p1] > y[p2]) y[p2] = y[p1];
+					else if (ISNAN_(y[p2])) y[p2] = y[p1];
+					if (y[p2] < t3)    t3 = y[p2];
+					p1++;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2++;
+				for (q=q2+1; q>0; q--) {
+					if (y[p1] > y[p2]) y[p2] = y[p1];
+					else if (ISNAN_(y[p2])) y[p2] = y[p1];
+					if (y[p2] < t3)    t3 = y[p2];
+					p1++;
+					p2++;
+				}
+				break; /* case complete_linkage */
+
+			case weighted_linkage:
+				for (q=bn-bc-1; q>q1; q--) {
+					t2 = (y[p1] + y[p2])/2;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1 = p1 + q;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2 = p2 + q;
+				for (q=q1-1;  q>q2; q--) {
+					t2 = (y[p1] + y[p2])/2;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2++;
+				for (q=q2+1; q>0; q--) {
+					t2 = (y[p1] + y[p2])/2;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2++;
+				}
+				break; /* case weighted_linkage */
+
+			case centroid_linkage:
+				for (q=bn-bc-1; q>q1; q--) {
+					t2 = y[p1] * rnk + y[p2] * rnl - t1;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1 = p1 + q;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2 = p2 + q;
+				for (q=q1-1;  q>q2; q--) {
+					t2 = y[p1] * rnk + y[p2] * rnl - t1;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2++;
+				for (q=q2+1; q>0; q--) {
+					t2 = y[p1] * rnk + y[p2] * rnl - t1;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2++;
+				}
+				break; /* case centroid_linkage */
+
+			case median_linkage:
+				for (q=bn-bc-1; q>q1; q--) {
+					t2 = (y[p1] + y[p2])/2 - t1;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1 = p1 + q;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2 = p2 + q;
+				for (q=q1-1;  q>q2; q--) {
+					t2 = (y[p1] + y[p2])/2 - t1;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2 = p2 + q;
+				}
+				p1++;
+				p2++;
+				for (q=q2+1; q>0; q--) {
+					t2 = (y[p1] + y[p2])/2 - t1;
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2++;
+				}
+				break; /* case median_linkage */
+
+			case ward_linkage:
+				for (q=bn-bc-1,g=bc; q>q1; q--) {
+					ng = scl[g++];
+					t2 = (y[p1]*(nk+ng) + y[p2]*(nl+ng) - t1*ng) / (nkpnl+ng);
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1 = p1 + q;
+					p2 = p2 + q;
+				}
+				g++;
+				p1++;
+				p2 = p2 + q;
+				for (q=q1-1;  q>q2; q--) {
+					ng = scl[g++];
+					t2 = (y[p1]*(nk+ng) + y[p2]*(nl+ng) - t1*ng) / (nkpnl+ng);
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2 = p2 + q;
+				}
+				g++;
+				p1++;
+				p2++;
+				for (q=q2+1; q>0; q--) {
+					ng = scl[g++];
+					t2 = (y[p1]*(nk+ng) + y[p2]*(nl+ng) - t1*ng) / (nkpnl+ng);
+					if (t2<t3) t3=t2;
+					y[p2] = t2;
+					p1++;
+					p2++;
+				}
+				break; /* case ward_linkage */
+
+			} /* switch (method_key) */
+
+			/*
+			moves the leftmost column "bc" to row/col "k" */
+			if (k!=bc) {
+				q1 = bn - k;
+
+				p1 = (mwSize)Y.offset(bc, k);
+				p2 = (mwSize)Y.offset(bc, bc + 1);
+
+				for (q=bn-bc-1; q>q1; q--) {
+					p1 = p1 + q;
+					y[p1] = y[p2++];
+				}
+				p1 = p1 + q + 1;
+				p2++;
+				for ( ; q>0; q--) {
+					y[p1++] = y[p2++];
+				}
+			} /*if (k!=bc) */
+		} /*for (bc=0,bp=m;bc<bn;bc++,bp++) */
+
+		/* loop to fill with NaN's in case the main loop ended prematurely */
+		for (;bc<bn;bc++,bp++) {
+			k=bc; l=bc+1;
+			if (obp[k]<obp[l]) {
+				*b1++ = (TEMPL) (obp[k]+1);
+				*b2++ = (TEMPL) (obp[l]+1);
+			} else {
+				*b1++ = (TEMPL) (obp[l]+1);
+				*b2++ = (TEMPL) (obp[k]+1);
+			}
+			obp[l] = bp;
+			*s++ = arma::datum::nan;
+		}
+
+		return out;
+	}
+
+	template <typename eT>
+	inline mat linkagemex(const condensed_distance<eT>& Y, linkage_method method = single_linkage, double* work = nullptr)
+	{
+		linkage_workspace ws;
+		return linkagemex(Y, method, work, ws);
+	}
+
+	/// Root of the set of x, with path halving.
+	inline uword linkage_find(std::vector<uword>& parent, uword x)
+	{
+		while (parent[x] != x) {
+			parent[x] = parent[parent[x]];
+			x = parent[x];
+		}
+		return x;
+	}
+
+	/// Orders merges by key.
+	struct linkage_key_less
+	{
+		const std::vector<double>& key;
+
+		explicit linkage_key_less(const std::vector<double>& k) : key(k) {}
+
+		bool operator()(const uword a, const uword b) const
+		{
+			return key[a] < key[b];
+		}
+	};
+
+
+	/**
+	 *	@brief	Encodes merges found in any order as a cluster tree.<br>
+	 *			The merge r joins the clusters that contain the observations left[r] and right[r] at height[r].
+	 *			The merges are sorted by key, which must not be less than the keys of the merges of the
+	 *			children, and the clusters are numbered as by #linkage, that is,
+	 *			the observations are \f$1, \cdots, m\f$, and the cluster formed at the row \f$r\f$ is \f$m + r\f$.
+	 */
+	inline mat linkage_tree(const uword m, const std::vector<uword>& left, const std::vector<uword>& right,
+		const std::vector<double>& height, const std::vector<double>& key, linkage_workspace& ws)
+	{
+		if (m < 2) return mat(0, 3);
+
+		const uword bn = m - 1;
+		std::vector<uword>& order = ws.order;
+		order.resize(bn);
+		for (uword r = 0 ; r < bn ; r++) order[r] = r;
+		std::stable_sort(order.begin(), order.end(), linkage_key_less(key));
+
+		// union-find over the observations; node[root] is the 0-based number of the cluster
+		std::vector<uword>& parent = ws.parent, & node = ws.node;
+		parent.resize(m); node.resize(m);
+		for (uword i = 0 ; i < m ; i++) parent[i] = node[i] = i;
+
+		mat out(bn, 3);
+		for (uword r = 0 ; r < bn ; r++) {
+			const uword k = order[r];
+			const uword ra = linkage_find(parent, left[k]), rb = linkage_find(parent, right[k]);
+			const uword na = node[ra], nb = node[rb];
+
+			out.at(r, 0) = (double)(std::min(na, nb) + 1);
+			out.at(r, 1) = (double)(std::max(na, nb) + 1);
+			out.at(r, 2) = height[k];
+
+			parent[ra] = rb;
+			node[rb] = m + r;
+		}
+
+		return out;
+	}
+
+	inline mat linkage_tree(const uword m, const std::vector<uword>& left, const std::vector<uword>& right,
+		const std::vector<double>& height, const std::vector<double>& key)
+	{
+		linkage_workspace ws;
+		return linkage_tree(m, left, right, height, key, ws);
+	}
+
+
+	/**
+	 *	@brief	Nearest-neighbor chain algorithm for the reducible methods (complete, average, weighted and ward).<br>
+	 *			The merges are found in \f$O(m^2)\f$ time, out of order, and are sorted by height afterwards.
+	 *			If @c work is given, the merges are computed in it instead of a copy of the distances.
+	 *			If @c weight is given, the observations are clusters of weight[i] observations.
+	 */
+	template <typename eT>
+	mat linkage_nnchain(const condensed_distance<eT>& Y, const linkage_method method, double* work, linkage_workspace& ws,
+		const uword* weight = nullptr)
+	{
+		const uword m = Y.n_obs(), n = Y.size();
+		const eT* yi = Y.memptr();
+
+		// ward's linkage merges on squared distances
+		const bool squared = (method == ward_linkage);
+
+		if (work == nullptr) {
+			ws.y.resize(n + 1);
+			work = &ws.y[0];
+		}
+
+		if (squared)
+			for (uword i = 0 ; i < n ; i++) work[i] = (double)yi[i] * yi[i];
+		else if ((const void*)work != (const void*)yi)
+			std::copy(yi, yi + n, work);
+
+		condensed_distance<double> D(work, m);
+
+		std::vector<uword>& scl = ws.size, & chain = ws.chain, & left = ws.left, & right = ws.right;
+		std::vector<double>& height = ws.height, & key = ws.key, & level = ws.level;
+		std::vector<char>& active = ws.active;
+		if (weight) scl.assign(weight, weight + m);
+		else scl.assign(m, 1);
+		left.resize(m); right.resize(m);
+		height.resize(m); key.resize(m); level.assign(m, -datum::inf);
+		active.assign(m, 1);
+		chain.clear(); chain.reserve(m);
+
+		uword first = 0;	// smallest active cluster
+		for (uword r = 0 ; r + 1 < m ; r++) {
+			if (chain.empty()) {
+				while (!active[first]) first++;
+				chain.push_back(first);
+			}
+
+			// grow the chain until the last two clusters are reciprocal nearest neighbors
+			uword a, b;
+			double d;
+			for (;;) {
+				a = chain.back();
+
+				// the previous cluster of the chain wins ties, so the chain always terminates
+				const uword prev = chain.size() > 1 ? chain[chain.size() - 2] : m;
+				b = prev;
+				d = (prev < m) ? D(a, prev) : datum::inf;
+
+				for (uword x = 0 ; x < m ; x++) {
+					if (!active[x] || x == a) continue;
+					const double dx = D(a, x);
+					if (dx < d || b == m) { d = dx; b = x; }
+				}
+
+				if (b == prev) break;
+				chain.push_back(b);
+			}
+			chain.pop_back();
+			chain.pop_back();
+
+			left[r] = a; right[r] = b; height[r] = squared ? std::sqrt(d) : d;
+
+			// rounding may place a merge slightly below its children; order by the monotone level
+			key[r] = level[b] = std::max(height[r], std::max(level[a], level[b]));
+
+			// the merged cluster takes the place of b
+			const double na = (double)scl[a], nb = (double)scl[b];
+			for (uword x = 0 ; x < m ; x++) {
+				if (!active[x] || x == a || x == b) continue;
+
+				const uword xb = x < b ? D.offset(x, b) : D.offset(b, x);
+				const double da = D(a, x), db = work[xb];
+
+				switch (method) {
+				case complete_linkage:
+					work[xb] = std::max(da, db);
+					break;
+				case average_linkage:
+					work[xb] = (na * da + nb * db) / (na + nb);
+					break;
+				case weighted_linkage:
+					work[xb] = (da + db) / 2;
+					break;
+				default:	// ward_linkage
+					{
+						const double nx = (double)scl[x];
+						work[xb] = ((na + nx) * da + (nb + nx) * db - nx * d) / (na + nb + nx);
+					}
+					break;
+				}
+			}
+
+			active[a] = 0;
+			scl[b] += scl[a];
+		}
+
+		return linkage_tree(m, left, right, height, key, ws);
+	}
+
+	/// Selects the algorithm for the method; distances with NaN are left to linkagemex.
+	template <typename eT>
+	mat linkage_dispatch(const condensed_distance<eT>& Y, const linkage_method method, double* work, linkage_workspace& ws)
+	{
+		switch (method) {
+		case complete_linkage:
+		case average_linkage:
+		case weighted_linkage:
+		case ward_linkage:
+			{
+				const eT* yi = Y.memptr();
+				bool has_nan = false;
+				for (uword i = 0 ; i < Y.size() && !has_nan ; i++) has_nan = (yi[i] != yi[i]);
+				if (!has_nan) return linkage_nnchain(Y, method, work, ws);
+			}
+			break;
+		default:
+			break;
+		}
+
+		return linkagemex(Y, method, work, ws);
+	}
+
+	template <typename eT>
+	inline mat linkage_dispatch(const condensed_distance<eT>& Y, const linkage_method method, double* work = nullptr)
+	{
+		linkage_workspace ws;
+		return linkage_dispatch(Y, method, work, ws);
+	}
+
+	/**
+	 *	@brief	Single linkage of the packed observations P by Prim's algorithm.<br>
+	 *			The distances are computed as the vertices join the tree, so only \f$O(m)\f$ distances are kept.
+	 *			The remaining vertices are kept contiguous, and their distances to the tree are updated in parallel.
+	 */
+	struct linkage_prim
+	{
+		template <typename metric_type>
+		static void apply(const mat& P, mat& Z, const metric_type& metric)
+		{
+			const uword n = P.n_rows, m = P.n_cols;
+			if (m < 2) { Z.set_size(0, 3); return; }
+
+			std::vector<uword> rest(m - 1), from(m, 0), left(m - 1), right(m - 1);
+			std::vector<double> dist(m, datum::inf), height(m - 1);
+			for (uword i = 1 ; i < m ; i++) rest[i - 1] = i;
+
+			uword v = 0;	// the vertex that joined the tree last
+			for (uword r = 0 ; r + 1 < m ; r++) {
+				const uword nr = rest.size();
+				const double* a = P.colptr(v);
+
+				ARMA_EXT_PARALLEL_FOR(k, nr)
+					const uword x = rest[k];
+					const double d = metric(a, P.colptr(x), n);
+					if (d < dist[x]) { dist[x] = d; from[x] = v; }
+				ARMA_EXT_PARALLEL_END
+
+				// the nearest remaining vertex joins the tree; vertices that are not comparable go last
+				uword best = 0;
+				for (uword k = 1 ; k < nr ; k++)
+					if (dist[rest[k]] < dist[rest[best]]) best = k;
+
+				v = rest[best];
+				left[r] = from[v]; right[r] = v; height[r] = dist[v];
+
+				rest[best] = rest.back();
+				rest.pop_back();
+			}
+
+			// the edges of a minimum spanning tree merged in increasing order are the single linkage
+			Z = linkage_tree(m, left, right, height, height);
+		}
+	};
+
+	/**
+	 *	Distance between clusters represented by their centroids, stored as the columns of C.
+	 *	Ward's distance \f$\frac{2 n_a n_b}{n_a + n_b} \|c_a - c_b\|^2\f$ is the Lance-Williams
+	 *	distance of the squared Euclidean distances, and the centroid and median distances are
+	 *	the squared Euclidean distances between the (weighted) centroids.
+	 */
+	struct linkage_centroid_distance
+	{
+		const mat& C;
+		const std::vector<double>& size;
+		const bool ward;
+
+		linkage_centroid_distance(const mat& C_, const std::vector<double>& size_, const bool ward_)
+			: C(C_), size(size_), ward(ward_) {}
+
+		inline double operator()(const uword a, const uword b) const
+		{
+			const double d = metric_squaredeuclidean()(C.colptr(a), C.colptr(b), C.n_rows);
+			return ward ? 2 * size[a] * size[b] / (size[a] + size[b]) * d : d;
+		}
+	};
+
+	/// Computes buf[k] = D(a, alive[k]) in parallel.
+	template <typename dist_type>
+	inline void linkage_scan(const dist_type& D, const std::vector<uword>& alive, const uword a, std::vector<double>& buf)
+	{
+		const uword na = alive.size();
+
+		ARMA_EXT_PARALLEL_FOR(k, na)
+			buf[k] = (alive[k] == a) ? datum::inf : D(a, alive[k]);
+		ARMA_EXT_PARALLEL_END
+	}
+
+	/// Finds the nearest cluster of x among the alive clusters.
+	template <typename dist_type>
+	inline void linkage_nearest(const dist_type& D, const std::vector<uword>& alive, const uword x, uword& nn, double& nd)
+	{
+		nn = x; nd = datum::inf;
+		for (uword k = 0 ; k < alive.size() ; k++) {
+			const uword y = alive[k];
+			if (y == x) continue;
+			const double d = D(x, y);
+			if (d < nd || nn == x) { nd = d; nn = y; }
+		}
+	}
+
+	/// Merges the centroid of the cluster a into the cluster b.
+	inline void linkage_merge_centroid(mat& C, std::vector<double>& size, const uword a, const uword b, const bool weighted)
+	{
+		const uword n = C.n_rows;
+		const double wa = weighted ? size[a] : 1, wb = weighted ? size[b] : 1;
+		const double* ca = C.colptr(a);
+		double* cb = C.colptr(b);
+		for (uword i = 0 ; i < n ; i++)
+			cb[i] = (wa * ca[i] + wb * cb[i]) / (wa + wb);
+		size[b] += size[a];
+	}
+
+	/**
+	 *	@brief	Ward, centroid or median linkage of the observations (rows of X) with the Euclidean distance.<br>
+	 *			The centroids of the clusters are kept as the columns of an n-by-m matrix, so that the memory is
+	 *			\f$O(mn)\f$ instead of \f$O(m^2)\f$ for the pairwise distances.
+	 *			Ward's linkage is reducible and is computed by the nearest-neighbor chain algorithm.
+	 *			The centroid and median linkages are not, so the merges are found in order from the nearest
+	 *			neighbor of each cluster, which is updated only when it is merged or the merged cluster is nearer.
+	 *			If @c weight is given, the observations are the centroids of clusters of weight[i] observations.
+	 */
+	inline mat linkage_centroids(const mat& X, const linkage_method method, const std::vector<double>* weight = nullptr)
+	{
+		const uword m = X.n_rows;
+		if (m < 2) return mat(0, 3);
+
+		mat C = trans(X);	// centroid of each cluster
+		std::vector<double> size(m, 1), buf(m), height(m - 1), key(m - 1), level(m, -datum::inf);
+		if (weight) size = *weight;
+		std::vector<uword> alive(m), pos(m), left(m - 1), right(m - 1);
+		for (uword i = 0 ; i < m ; i++) alive[i] = pos[i] = i;
+
+		const bool ward = (method == ward_linkage);
+		const linkage_centroid_distance D(C, size, ward);
+
+		std::vector<uword> chain, nn, stale;
+		std::vector<double> nd;
+		if (ward)
+			chain.reserve(m);
+		else {
+			nn.resize(m); nd.resize(m);
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(x, m, 16)
+				linkage_nearest(D, alive, x, nn[x], nd[x]);
+			ARMA_EXT_PARALLEL_END
+		}
+
+		for (uword r = 0 ; r + 1 < m ; r++) {
+			uword a, b;
+			double d;
+
+			if (ward) {
+				if (chain.empty()) chain.push_back(alive[0]);
+
+				// grow the chain until the last two clusters are reciprocal nearest neighbors
+				for (;;) {
+					a = chain.back();
+					linkage_scan(D, alive, a, buf);
+
+					// the previous cluster of the chain wins ties, so the chain always terminates
+					const uword prev = chain.size() > 1 ? chain[chain.size() - 2] : m;
+					b = prev;
+					d = (prev < m) ? buf[pos[prev]] : datum::inf;
+
+					for (uword k = 0 ; k < alive.size() ; k++) {
+						if (alive[k] == a) continue;
+						if (buf[k] < d || b == m) { d = buf[k]; b = alive[k]; }
+					}
+
+					if (b == prev) break;
+					chain.push_back(b);
+				}
+				chain.pop_back();
+				chain.pop_back();
+			}
+			else {
+				// the closest pair of clusters
+				a = alive[0];
+				for (uword k = 1 ; k < alive.size() ; k++)
+					if (nd[alive[k]] < nd[a]) a = alive[k];
+				b = nn[a];
+				d = nd[a];
+			}
+
+			left[r] = a; right[r] = b; height[r] = std::sqrt(d);
+			if (ward)
+				key[r] = level[b] = std::max(height[r], std::max(level[a], level[b]));
+			else
+				key[r] = (double)r;	// the merges are in order, inversions included
+
+			// the merged cluster takes the place of b
+			linkage_merge_centroid(C, size, a, b, method != median_linkage);
+			alive[pos[a]] = alive.back();
+			pos[alive.back()] = pos[a];
+			alive.pop_back();
+
+			if (!ward && alive.size() > 1) {
+				linkage_scan(D, alive, b, buf);
+				nn[b] = b; nd[b] = datum::inf;
+				stale.clear();
+
+				for (uword k = 0 ; k < alive.size() ; k++) {
+					const uword x = alive[k];
+					if (x == b) continue;
+					if (buf[k] < nd[b] || nn[b] == b) { nd[b] = buf[k]; nn[b] = x; }
+
+					if (nn[x] == a || nn[x] == b)
+						stale.push_back(x);
+					else if (buf[k] < nd[x]) {
+						nd[x] = buf[k]; nn[x] = b;
+					}
+				}
+
+				const uword ns = stale.size();
+				ARMA_EXT_PARALLEL_FOR_DYNAMIC(k, ns, 1)
+					linkage_nearest(D, alive, stale[k], nn[stale[k]], nd[stale[k]]);
+				ARMA_EXT_PARALLEL_END
+			}
+		}
+
+		return linkage_tree(m, left, right, height, key);
+	}
+#endif
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree of observations.
+	 *	@param X The real matrix of observations, one per row.
+	 *	@param method The algorithm for computing the distance between clusters.
+	 *	@param metric The distance metric between observations, as for #pdist.
+	 *	@return A matrix that encodes a tree of hierarchical cluster of the rows of X.
+	 *	@see	linkage
+	 *	@note	The single linkage, and the ward, centroid and median linkages with the Euclidean distance,
+	 *			are computed directly from the observations, without the pairwise distances.
+	 */
+	inline mat linkage(const mat& X, linkage_method method, distance_type metric)
+	{
+		if (method == single_linkage) {
+			const pdist_metric pm(X, metric);
+			const mat P = pm.pack(X);
+			mat Z;
+			pdist_dispatch<linkage_prim>(pm, P, Z);
+			return Z;
+		}
+
+		if ((method == ward_linkage || method == centroid_linkage || method == median_linkage) && metric == euclidean) {
+			bool has_nan = false;
+			for (uword i = 0 ; i < X.n_elem && !has_nan ; i++) has_nan = (X[i] != X[i]);
+			if (!has_nan) return linkage_centroids(X, method);
+		}
+
+		vec y = pdist(X, metric);
+		return linkage_dispatch(condensed_distance<double>(y), method, y.memptr());
+	}
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree.
+	 *	@param X The real matrix of observation or the vector of pairwise distance of the observations.
+	 *	@param method The algorithm for computing the distance between clusters.
+	 *	@return A matrix that encodes a tree of hierarchical cluster of the rows of the real matrix X or the vector of pairwise distances of matrix.<br>
+	 *			It is \f$(m - 1)\f$-by-\f$3\f$ matrix, where \f$ m \f$ is the number of observations in the original data.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/linkage.html
+	 *	@note	A vector is taken as pairwise distances, and a matrix as observations with the Euclidean distance,
+	 *			so an \f$m\f$-by-\f$1\f$ matrix of observations of a single variable must be clustered with
+	 *			linkage(const mat&, linkage_method, distance_type).<br>
+	 *			The complete, average, weighted and ward methods use the nearest-neighbor chain algorithm,
+	 *			and the others the linkagemex algorithm.
+	 */
+	template <typename mat_type>
+	inline mat linkage(const mat_type& X, linkage_method method = single_linkage)
+	{
+		if (X.is_vec() || X.n_elem == 0)
+			return linkage_dispatch(condensed_distance<typename mat_type::elem_type>(X), method);
+		return linkage(conv_to<mat>::from(X), method, euclidean);
+	}
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree of condensed distances.
+	 *	@param Y The view of the pairwise distances.
+	 *	@param method The algorithm for computing the distance between clusters.
+	 *	@return A matrix that encodes a tree of hierarchical cluster.
+	 *	@see	linkage
+	 */
+	template <typename eT>
+	inline mat linkage(const condensed_distance<eT>& Y, linkage_method method = single_linkage)
+	{
+		return linkage_dispatch(Y, method);
+	}
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree of condensed distances, with the buffers of a workspace.
+	 *	@param Y The view of the pairwise distances.
+	 *	@param method The algorithm for computing the distance between clusters.
+	 *	@param ws The buffers, which are kept for the following calls.
+	 *	@return A matrix that encodes a tree of hierarchical cluster.
+	 *	@see	linkage
+	 */
+	template <typename eT>
+	inline mat linkage(const condensed_distance<eT>& Y, linkage_method method, linkage_workspace& ws)
+	{
+		return linkage_dispatch(Y, method, nullptr, ws);
+	}
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree, with the buffers of a workspace.
+	 *	@param X The real matrix of observation or the vector of pairwise distance of the observations.
+	 *	@param method The algorithm for computing the distance between clusters.
+	 *	@param ws The buffers, which are kept for the following calls.
+	 *	@return A matrix that encodes a tree of hierarchical cluster.
+	 *	@note	As for linkage(const mat_type&, linkage_method), a vector is taken as pairwise distances, and a matrix
+	 *			as observations with the Euclidean distance; the workspace only serves the distances.
+	 *	@see	linkage
+	 */
+	template <typename eT>
+	inline mat linkage(const Mat<eT>& X, linkage_method method, linkage_workspace& ws)
+	{
+		if (X.is_vec() || X.n_elem == 0)
+			return linkage_dispatch(condensed_distance<eT>(X), method, nullptr, ws);
+
+		return linkage(conv_to<mat>::from(X), method, euclidean);
+	}
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree of pairwise distances, computed in place.<br>
+	 *			The merges are computed in @c y instead of a copy, so the distances are overwritten.
+	 *	@param y The pairwise distances, as generated by #pdist function.
+	 *	@param method The algorithm for computing the distance between clusters.
+	 *	@param ws The buffers, which are kept for the following calls.
+	 *	@return A matrix that encodes a tree of hierarchical cluster.
+	 *	@see	linkage
+	 */
+	inline mat linkage_inplace(vec& y, linkage_method method, linkage_workspace& ws)
+	{
+		return linkage_dispatch(condensed_distance<double>(y), method, y.memptr(), ws);
+	}
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree of pairwise distances, computed in place.
+	 *	@see	linkage_inplace(vec&, linkage_method, linkage_workspace&)
+	 */
+	inline mat linkage_inplace(vec& y, linkage_method method = single_linkage)
+	{
+		linkage_workspace ws;
+		return linkage_inplace(y, method, ws);
+	}
+
+	/**
+	 *	@brief	Agglomerative hierarchical cluster tree of the distances in a memory-mapped file.
+	 *	@param Y The pairwise distances, as generated by #pdist_mapped function.
+	 *			 The merges are computed in place, so the distances in the file are overwritten.
+	 *	@return A matrix that encodes a tree of hierarchical cluster.
+	 *	@see	linkage
+	 */
+	inline mat linkage(mapped_distance& Y, linkage_method method = single_linkage)
+	{
+		return linkage_dispatch(condensed_distance<double>(Y), method, Y.memptr());
+	}
+
+	/**
+	 *	@brief	Single linkage of a graph of the pairs within a distance, by Kruskal's algorithm.<br>
+	 *			The merges up to the radius of the graph are those of the single linkage of all the pairs.
+	 *			The clusters that are not connected by the graph are merged last at infinite height,
+	 *			in the order of their first observations.
+	 *	@param G The graph of the pairs, as generated by #pdist_radius function.
+	 *	@param method The algorithm for computing the distance between clusters; only #single_linkage is supported.
+	 *	@return A matrix that encodes a tree of hierarchical cluster.
+	 *	@see	linkage
+	 */
+	inline mat linkage(const distance_graph& G, linkage_method method = single_linkage)
+	{
+		if (method != single_linkage)
+			throw std::invalid_argument("Only single linkage is supported for a distance graph.");
+
+		const uword m = G.n_obs, e = G.col.n_elem;
+		if (m < 2) return mat(0, 3);
+
+		// the pairs are sorted by distance, and the pairs of equal distances stay in the order of the graph
+		std::vector<double> d(G.dist.begin(), G.dist.end());
+		std::vector<uword> order(e);
+		for (uword k = 0 ; k < e ; k++) order[k] = k;
+		std::stable_sort(order.begin(), order.end(), linkage_key_less(d));
+
+		std::vector<uword> row(e);
+		for (uword i = 0 ; i < m ; i++)
+			for (uword k = G.row_ptr[i] ; k < G.row_ptr[i + 1] ; k++) row[k] = i;
+
+		std::vector<uword> parent(m), left, right;
+		std::vector<double> height;
+		left.reserve(m - 1); right.reserve(m - 1); height.reserve(m - 1);
+		for (uword i = 0 ; i < m ; i++) parent[i] = i;
+
+		for (uword k = 0 ; k < e && left.size() + 1 < m ; k++) {
+			const uword a = row[order[k]], b = G.col[order[k]];
+			const uword ra = linkage_find(parent, a), rb = linkage_find(parent, b);
+			if (ra == rb) continue;
+
+			parent[ra] = rb;
+			left.push_back(a); right.push_back(b); height.push_back(d[order[k]]);
+		}
+
+		for (uword i = 1 ; i < m && left.size() + 1 < m ; i++) {
+			const uword ra = linkage_find(parent, 0), rb = linkage_find(parent, i);
+			if (ra == rb) continue;
+
+			parent[rb] = ra;
+			left.push_back(0); right.push_back(i); height.push_back(datum::inf);
+		}
+
+		return linkage_tree(m, left, right, height, height);
+	}
+
+	/**
+	 *	@brief	Construct clusters from the agglomerative hierarchical cluster tree
+	 *	@param Z The agglomerative hierarchical cluster tree, as generated by #linkage function.
+	 *	@param c A threshold for cutting Z into clusters.
+	 *	@return	The cluster indices for each of observations.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/cluster.html
+	 *	@note	The tree is cut in a single pass from the leaves up, and labeled in a single pass from the root down,
+	 *			in \f$O(m)\f$ time.
+	 */
+	inline uvec cluster(const mat& Z, double c)
+	{
+		const uword n = Z.n_rows;
+		uvec T(n + 1);
+		std::vector<double> h;
+		std::vector<char> conn(n);
+		std::vector<uword> key(2 * n + 1);
+
+		cluster_heights(Z, h);
+		for (uword r = 0 ; r < n ; r++) conn[r] = (h[r] <= c);
+		cluster_labels(Z, conn, T.memptr(), &key[0]);
+		return T;
+	}
+
+	/**
+	 *	@brief	Construct clusters from the agglomerative hierarchical cluster tree at many thresholds.
+	 *	@param Z The agglomerative hierarchical cluster tree, as generated by #linkage function.
+	 *	@param cutoffs The thresholds for cutting Z into clusters.
+	 *	@return	The matrix of cluster indices, whose column j is @c cluster(Z, cutoffs[j]).
+	 *	@note	The largest height below each merge is computed once, so each threshold takes a single
+	 *			labeling pass in \f$O(m)\f$ time. The thresholds are processed in parallel.
+	 *	@see	cluster(const mat&, double)
+	 */
+	inline umat cluster(const mat& Z, const vec& cutoffs)
+	{
+		const uword n = Z.n_rows, nc = cutoffs.n_elem;
+		umat T(n + 1, nc);
+
+		std::vector<double> h;
+		cluster_heights(Z, h);
+
+		ARMA_EXT_PARALLEL_FOR(j, nc)
+			const double c = cutoffs[j];
+			std::vector<char> conn(n);
+			std::vector<uword> key(2 * n + 1);
+
+			for (uword r = 0 ; r < n ; r++) conn[r] = (h[r] <= c);
+			cluster_labels(Z, conn, T.colptr(j), &key[0]);
+		ARMA_EXT_PARALLEL_END
+
+		return T;
+	}
+
+	/**
+	 *	@brief	Construct at most k clusters from the agglomerative hierarchical cluster tree.<br>
+	 *			The last k - 1 merges of Z are cut, as by the maxclust option of the MATLAB cluster function.
+	 *	@param Z The agglomerative hierarchical cluster tree, as generated by #linkage function.
+	 *	@param k The maximum number of clusters.
+	 *	@return	The cluster indices for each of observations.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/cluster.html
+	 */
+	inline uvec maxclust(const mat& Z, uword k)
+	{
+		const uword n = Z.n_rows;
+		uvec T(n + 1);
+		std::vector<char> conn;
+		std::vector<uword> key(2 * n + 1);
+
+		cluster_maxclust(Z, k, T.memptr(), conn, &key[0]);
+		return T;
+	}
+
+	/**
+	 *	@brief	Construct at most k clusters from the agglomerative hierarchical cluster tree, for many k.
+	 *	@param Z The agglomerative hierarchical cluster tree, as generated by #linkage function.
+	 *	@param k The maximum numbers of clusters.
+	 *	@return	The matrix of cluster indices, whose column j is @c maxclust(Z, k[j]).
+	 *	@see	maxclust(const mat&, uword)
+	 */
+	inline umat maxclust(const mat& Z, const uvec& k)
+	{
+		const uword n = Z.n_rows, nk = k.n_elem;
+		umat T(n + 1, nk);
+
+		for (uword j = 0 ; j < nk ; j++)
+			if (k[j] == 0) throw std::invalid_argument("The maximum number of clusters must be positive.");
+
+		ARMA_EXT_PARALLEL_FOR(j, nk)
+			std::vector<char> conn;
+			std::vector<uword> key(2 * n + 1);
+			cluster_maxclust(Z, k[j], T.colptr(j), conn, &key[0]);
+		ARMA_EXT_PARALLEL_END
+
+		return T;
+	}
+
+#ifndef DOXYGEN
+	/**
+	 *	Union-find over the observations that may be united concurrently. A root is linked under the smaller
+	 *	root by a compare-and-swap, and the paths are halved as they are followed, so the root of a set is its
+	 *	smallest element, whatever the order of the unions.
+	 */
+	class concurrent_forest
+	{
+	public:
+		explicit concurrent_forest(const uword m) : parent(m)
+		{
+			for (uword i = 0 ; i < m ; i++) parent[i] = i;
+		}
+
+		uword find(uword x)
+		{
+			for (;;) {
+				uword p = parent[x];
+				if (p == x) return x;
+				const uword g = parent[p];
+				if (g != p) cas(x, p, g);
+				x = g;
+			}
+		}
+
+		void unite(uword a, uword b)
+		{
+			for (;;) {
+				a = find(a); b = find(b);
+				if (a == b) return;
+				if (a < b) std::swap(a, b);
+				if (cas(a, a, b)) return;
+			}
+		}
+
+	private:
+#ifdef ARMA_EXT_USE_CPP11
+		std::vector<std::atomic<uword> > parent;
+
+		bool cas(const uword x, uword expected, const uword desired)
+		{
+			return parent[x].compare_exchange_strong(expected, desired);
+		}
+#else
+		std::vector<uword> parent;	// the unions are serial
+
+		bool cas(const uword x, const uword expected, const uword desired)
+		{
+			if (parent[x] != expected) return false;
+			parent[x] = desired;
+			return true;
+		}
+#endif
+	};
+
+	/// Counts the neighbors of the queries [p0, p1) in tree order.
+	struct dbscan_count
+	{
+		const kdtree& T;
+		std::vector<uword>& count;
+
+		dbscan_count(const kdtree& T_, std::vector<uword>& count_) : T(T_), count(count_) {}
+
+		void operator()(const uword p0, const uword p1, const field<uvec>& I)
+		{
+			for (uword p = p0 ; p < p1 ; p++) count[T.index[p]] = I(p - p0).n_elem;
+		}
+	};
+
+	/// Unites the core points of the queries [p0, p1) with their core neighbors, and attaches the border points to their nearest core neighbor.
+	struct dbscan_unite
+	{
+		const kdtree& T;
+		const std::vector<char>& core;
+		concurrent_forest& forest;
+		std::vector<uword>& attach;
+
+		dbscan_unite(const kdtree& T_, const std::vector<char>& core_, concurrent_forest& forest_, std::vector<uword>& attach_)
+			: T(T_), core(core_), forest(forest_), attach(attach_) {}
+
+		void operator()(const uword p0, const uword p1, const field<uvec>& I)
+		{
+			const uword np = p1 - p0;
+
+#ifdef ARMA_EXT_USE_CPP11
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(j, np, 256)
+#else
+			// the unions of the forest are serial without atomics
+			for (uword j = 0 ; j < np ; j++) {
+#endif
+				const uword q = T.index[p0 + j];
+				const uvec& nb = I(j);
+
+				if (core[q]) {
+					for (uword l = 0 ; l < nb.n_elem ; l++)
+						if (nb[l] < q && core[nb[l]]) forest.unite(q, nb[l]);
+				}
+				else {
+					// the neighbors are in ascending order of distance
+					for (uword l = 0 ; l < nb.n_elem ; l++)
+						if (core[nb[l]]) { attach[q] = nb[l]; break; }
+				}
+#ifdef ARMA_EXT_USE_CPP11
+			ARMA_EXT_PARALLEL_END
+#else
+			}
+#endif
+		}
+	};
+
+	/// Radius queries of the observations of the tree, in blocks of tree order so that the neighbors of a block are never kept at once.
+	template <typename func_type>
+	void dbscan_blocks(const kdtree& T, const double epsilon, func_type& f)
+	{
+		const uword n = T.P.n_rows, m = T.n_obs();
+		const uword bs = 65536;
+		field<uvec> I;
+		field<vec> D;
+
+		for (uword p0 = 0 ; p0 < m ; p0 += bs) {
+			const uword p1 = std::min(p0 + bs, m);
+			const mat PY(const_cast<double*>(T.P.memptr()) + p0 * n, n, p1 - p0, false);
+			T.radius_packed(PY, epsilon, I, D);
+			f(p0, p1, I);
+		}
+	}
+
+	/// Orders the edges (w, a, b), a < b, of the mutual reachability graph.
+	inline bool hdbscan_less(const double w1, const uword a1, const uword b1, const double w2, const uword a2, const uword b2)
+	{
+		return w1 < w2 || (w1 == w2 && (a1 < a2 || (a1 == a2 && b1 < b2)));
+	}
+
+	/**
+	 *	One round of Boruvka's algorithm over the mutual reachability distances of the observations of the tree:
+	 *	finds for each observation, in parallel, the nearest observation of another component, if it is not farther
+	 *	than a known edge out of the component. A node is skipped if all its observations are in the component of
+	 *	the query, or if the distance to its bounding box or the smallest core distance of its observations exceeds
+	 *	the nearest so far.
+	 */
+	struct hdbscan_round
+	{
+		const kdtree& T;
+		const std::vector<double>& core;		// core distances in tree order
+		const std::vector<uword>& comp;			// components in tree order
+		const std::vector<double>& node_core;	// smallest core distance of each node
+		const std::vector<uword>& node_comp;	// component of each node, or m if mixed
+		const std::vector<double>& bound;		// weight of an edge out of each component
+		std::vector<double>& best_w;
+		std::vector<uword>& best_j;
+
+		hdbscan_round(const kdtree& T_, const std::vector<double>& core_, const std::vector<uword>& comp_,
+			const std::vector<double>& node_core_, const std::vector<uword>& node_comp_, const std::vector<double>& bound_,
+			std::vector<double>& best_w_, std::vector<uword>& best_j_)
+			: T(T_), core(core_), comp(comp_), node_core(node_core_), node_comp(node_comp_), bound(bound_),
+			best_w(best_w_), best_j(best_j_) {}
+
+		template <typename norm_type>
+		void operator()(const norm_type& f)
+		{
+			const uword n = T.P.n_rows, m = T.n_obs();
+			const double slack = kdtree::slack();
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(q, m, 256)
+				const double* x = T.P.colptr(q);
+
+				// an edge out of the component bounds the search
+				double w = bound[comp[q]];
+				uword b = m;
+
+				std::vector<std::pair<double, uword> > stack;
+				stack.push_back(std::make_pair(core[q], uword(0)));
+
+				while (!stack.empty()) {
+					const double lb = stack.back().first;
+					const uword t = stack.back().second;
+					stack.pop_back();
+
+					if (node_comp[t] == comp[q] || lb * (1 - slack) > w) continue;
+
+					const kdtree::node& nd = T.nodes[t];
+					if (nd.left == 0) {
+						for (uword i = nd.begin ; i < nd.end ; i++) {
+							if (comp[i] == comp[q]) continue;
+							double d = f.distance(T.P.colptr(i), x, n);
+							if (!T.squared) d = f.expand(d);
+							d = std::max(d, std::max(core[q], core[i]));
+							if (b == m ? d <= w : hdbscan_less(d, std::min(q, i), std::max(q, i), w, std::min(q, b), std::max(q, b))) {
+								w = d;
+								b = i;
+							}
+						}
+						continue;
+					}
+
+					double bl = T.bound(f, x, nd.left), br = T.bound(f, x, nd.left + 1);
+					if (!T.squared) { bl = f.expand(bl); br = f.expand(br); }
+					bl = std::max(bl, std::max(core[q], node_core[nd.left]));
+					br = std::max(br, std::max(core[q], node_core[nd.left + 1]));
+
+					if (bl <= br) {
+						stack.push_back(std::make_pair(br, nd.left + 1));
+						stack.push_back(std::make_pair(bl, nd.left));
+					}
+					else {
+						stack.push_back(std::make_pair(bl, nd.left));
+						stack.push_back(std::make_pair(br, nd.left + 1));
+					}
+				}
+
+				best_w[q] = w;
+				best_j[q] = b;
+			ARMA_EXT_PARALLEL_END
+		}
+	};
+#endif
+
+	/**
+	 *	@brief	Density-based spatial clustering of applications with noise (DBSCAN).<br>
+	 *			An observation with at least minpts observations (itself included) within distance epsilon is a
+	 *			core point. Core points within distance epsilon of each other are in the same cluster, and the other
+	 *			observations within distance epsilon of a core point join the cluster of the nearest such core point.
+	 *	@param X		The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param epsilon	The radius of the neighborhoods.
+	 *	@param minpts	The smallest number of observations in the neighborhood of a core point.
+	 *	@param type		The distance metric.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	The cluster indices (1-based) of the observations, numbered in the order of their first core points; -1 for noise.
+	 *	@see	http://www.mathworks.com/help/stats/dbscan.html
+	 *	@note	For the metrics of #kdtree, finite observations are searched with a #kdtree in blocks, in two passes,
+	 *			so that the neighborhoods are never kept at once. The queries run in parallel, and the core points are
+	 *			united by a concurrent union-find. Otherwise the neighborhoods are found by #pdist_radius.
+	 */
+	inline ivec dbscan(const mat& X, double epsilon, uword minpts, distance_type type = euclidean, double exponent = 2)
+	{
+		const uword m = X.n_rows;
+		if (minpts == 0)
+			throw std::invalid_argument("The minimum number of points must be positive.");
+
+		std::vector<uword> count(m, 1), attach(m, m);
+		std::vector<char> core(m);
+		concurrent_forest forest(m);
+
+		bool tree = true;
+		switch (type) {
+		case euclidean: case squaredeuclidean: case seuclidean: case cityblock: case minkowski:
+		case chebychev: case mahalanobis: case fasteuclidean: case fastsquaredeuclidean:
+			break;
+		default:
+			tree = false;
+			break;
+		}
+
+		if (tree && X.is_finite()) {
+			const kdtree T(X, type, exponent);
+
+			dbscan_count fc(T, count);
+			dbscan_blocks(T, epsilon, fc);
+			for (uword i = 0 ; i < m ; i++) core[i] = count[i] >= minpts;
+
+			dbscan_unite fu(T, core, forest, attach);
+			dbscan_blocks(T, epsilon, fu);
+		}
+		else {
+			const distance_graph G = pdist_radius(X, epsilon, type, exponent);
+
+			for (uword i = 0 ; i < m ; i++)
+				for (uword e = G.row_ptr[i] ; e < G.row_ptr[i + 1] ; e++) { count[i]++; count[G.col[e]]++; }
+			for (uword i = 0 ; i < m ; i++) core[i] = count[i] >= minpts;
+
+			std::vector<double> nearest(m, datum::inf);
+			for (uword i = 0 ; i < m ; i++) {
+				for (uword e = G.row_ptr[i] ; e < G.row_ptr[i + 1] ; e++) {
+					const uword j = G.col[e];
+					const double d = G.dist[e];
+					if (core[i] && core[j]) forest.unite(i, j);
+					else if (core[i] && (d < nearest[j] || (d == nearest[j] && i < attach[j]))) { nearest[j] = d; attach[j] = i; }
+					else if (core[j] && (d < nearest[i] || (d == nearest[i] && j < attach[i]))) { nearest[i] = d; attach[i] = j; }
+				}
+			}
+		}
+
+		ivec L(m);
+		std::vector<sword> id(m, 0);
+		sword k = 0;
+		for (uword i = 0 ; i < m ; i++) {
+			if (!core[i]) continue;
+			const uword r = forest.find(i);
+			if (id[r] == 0) id[r] = ++k;
+			L[i] = id[r];
+		}
+		for (uword i = 0 ; i < m ; i++)
+			if (!core[i]) L[i] = (attach[i] < m) ? L[attach[i]] : -1;
+
+		return L;
+	}
+
+	/**
+	 *	@brief	Hierarchical DBSCAN (HDBSCAN) cluster tree.<br>
+	 *			The single linkage of the mutual reachability distances
+	 *			\f$\max(d(a, b), \mathrm{core}(a), \mathrm{core}(b))\f$, where \f$\mathrm{core}(a)\f$ is the distance from
+	 *			\f$a\f$ to its minpts-th nearest observation (itself included). Cutting the tree by @c cluster(Z, epsilon)
+	 *			gives the clusters of DBSCAN at the radius epsilon without border points, in which the noise is singletons.
+	 *	@param X		The \f$m\f$-by-\f$n\f$ data matrix, whose elements must be finite.
+	 *	@param minpts	The number of observations of the core distances.
+	 *	@param type		The distance metric, one of the metrics of #kdtree.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return A matrix that encodes a tree of hierarchical cluster, as by #linkage.
+	 *	@note	The minimum spanning tree of the mutual reachability distances is found by Boruvka's algorithm over a
+	 *			#kdtree, whose nodes are skipped by their components and their smallest core distances. The nearest
+	 *			neighbors of the observations in each round are found in parallel.
+	 */
+	inline mat hdbscan(const mat& X, uword minpts, distance_type type = euclidean, double exponent = 2)
+	{
+		if (minpts == 0)
+			throw std::invalid_argument("The minimum number of points must be positive.");
+
+		const kdtree T(X, type, exponent);
+		const uword m = T.n_obs(), nn = T.nodes.size();
+		if (m < 2) return mat(0, 3);
+
+		// core distances in tree order
+		minpts = std::min(minpts, m);
+		std::vector<double> core(m);
+		{
+			mat D(minpts, m);
+			umat I(minpts, m);
+			T.knn_packed(T.P, minpts, D, I);
+			for (uword p = 0 ; p < m ; p++) core[p] = D.at(minpts - 1, p);
+		}
+
+		// the children of a node follow it
+		std::vector<double> node_core(nn);
+		for (uword t = nn ; t-- > 0 ; ) {
+			const kdtree::node& nd = T.nodes[t];
+			if (nd.left == 0) {
+				double c = datum::inf;
+				for (uword i = nd.begin ; i < nd.end ; i++) c = std::min(c, core[i]);
+				node_core[t] = c;
+			}
+			else
+				node_core[t] = std::min(node_core[nd.left], node_core[nd.left + 1]);
+		}
+
+		std::vector<uword> parent(m), comp(m), node_comp(nn), best_j(m, m), left, right;
+		std::vector<double> best_w(m), height;
+		for (uword p = 0 ; p < m ; p++) parent[p] = p;
+
+		while (left.size() + 1 < m) {
+			for (uword p = 0 ; p < m ; p++) comp[p] = linkage_find(parent, p);
+
+			for (uword t = nn ; t-- > 0 ; ) {
+				const kdtree::node& nd = T.nodes[t];
+				if (nd.left == 0) {
+					uword c = comp[nd.begin];
+					for (uword i = nd.begin + 1 ; i < nd.end && c < m ; i++)
+						if (comp[i] != c) c = m;
+					node_comp[t] = c;
+				}
+				else
+					node_comp[t] = (node_comp[nd.left] == node_comp[nd.left + 1]) ? node_comp[nd.left] : m;
+			}
+
+			// the edges of the last round that still leave their components bound the searches of this round
+			std::vector<double> bound(m, datum::inf);
+			for (uword p = 0 ; p < m ; p++)
+				if (best_j[p] < m && comp[best_j[p]] != comp[p]) bound[comp[p]] = std::min(bound[comp[p]], best_w[p]);
+
+			hdbscan_round f(T, core, comp, node_core, node_comp, bound, best_w, best_j);
+			T.dispatch(f);
+
+			// the lightest edge out of each component
+			std::vector<uword> ea(m, m), eb(m, m);
+			std::vector<double> ew(m, datum::inf);
+			for (uword p = 0 ; p < m ; p++) {
+				const uword j = best_j[p];
+				if (j == m) continue;
+				const uword c = comp[p], a = std::min(p, j), b = std::max(p, j);
+				if (ea[c] == m || hdbscan_less(best_w[p], a, b, ew[c], ea[c], eb[c])) {
+					ew[c] = best_w[p]; ea[c] = a; eb[c] = b;
+				}
+			}
+
+			const uword before = left.size();
+			for (uword c = 0 ; c < m ; c++) {
+				if (ea[c] == m) continue;
+				const uword ra = linkage_find(parent, ea[c]), rb = linkage_find(parent, eb[c]);
+				if (ra == rb) continue;
+
+				parent[ra] = rb;
+				left.push_back(T.index[ea[c]]);
+				right.push_back(T.index[eb[c]]);
+				height.push_back(ew[c]);
+			}
+			if (left.size() == before) break;
+		}
+
+		return linkage_tree(m, left, right, height, height);
+	}
+
+	/**
+	 *	@brief	Clustering feature (CF) tree of BIRCH, for streams of observations.<br>
+	 *			Each leaf entry summarizes the observations it absorbed by their number, linear sum and sum of
+	 *			squares, and each node summarizes its subtree. An observation descends to the nearest child
+	 *			centroid at each level, in \f$O(\log e)\f$ steps for \f$e\f$ entries, and is absorbed by the nearest
+	 *			entry of the leaf if the radius of the entry stays within the threshold; otherwise it starts a new
+	 *			entry. The nodes with more than the branching factor children are split at the farthest pair.
+	 *			When the number of entries exceeds the limit, the threshold is raised and the tree is rebuilt from
+	 *			its entries, so the memory is bounded. The entries are clustered by #linkage at any moment.
+	 */
+	class cftree
+	{
+	public:
+		/**
+		 *	@brief	Creates an empty tree.
+		 *	@param threshold_	The largest radius of a leaf entry.
+		 *	@param branching_	The largest number of children of a node.
+		 *	@param max_entries_	The largest number of leaf entries.
+		 */
+		cftree(const double threshold_ = 0, const uword branching_ = 50, const uword max_entries_ = 65536)
+			: T(threshold_), B(std::max<uword>(branching_, 2)), max_entries(std::max<uword>(max_entries_, 2)), n(0), seen(0), root(0)
+		{
+			if (!(threshold_ >= 0))
+				throw std::invalid_argument("The threshold must not be negative.");
+		}
+
+		/**
+		 *	@brief	Absorbs the observations (rows) of a chunk. The observations with NaN are skipped.
+		 */
+		void insert(const mat& X)
+		{
+			if (nodes.empty()) {
+				n = X.n_cols;
+				clear();
+			}
+			if (X.n_cols != n)
+				throw std::invalid_argument("The chunk must have the same number of columns as the previous chunks.");
+
+			std::vector<double> x(n);
+			for (uword i = 0 ; i < X.n_rows ; i++) {
+				double ss = 0;
+				bool valid = true;
+				for (uword d = 0 ; d < n ; d++) {
+					x[d] = X.at(i, d);
+					valid = valid && !(x[d] != x[d]);
+					ss += x[d] * x[d];
+				}
+				if (!valid) continue;
+
+				add(&x[0], 1, ss);
+				seen++;
+				if (n_entries() > max_entries) rebuild();
+			}
+		}
+
+		/// The number of leaf entries.
+		uword n_entries() const { return ecnt.size(); }
+
+		/// The number of observations absorbed.
+		uword n_obs() const { return seen; }
+
+		/// The current threshold.
+		double threshold() const { return T; }
+
+		/// The \f$e\f$-by-\f$n\f$ matrix of the centroids of the leaf entries.
+		mat centroids() const
+		{
+			mat C(n_entries(), n);
+			for (uword e = 0 ; e < n_entries() ; e++)
+				for (uword d = 0 ; d < n ; d++) C.at(e, d) = els[e * n + d] / ecnt[e];
+			return C;
+		}
+
+		/// The number of observations of each leaf entry.
+		uvec counts() const
+		{
+			uvec c(n_entries());
+			for (uword e = 0 ; e < n_entries() ; e++) c[e] = (uword)ecnt[e];
+			return c;
+		}
+
+		/**
+		 *	@brief	Agglomerative hierarchical cluster tree of the leaf entries.<br>
+		 *			The entries are weighted by their numbers of observations for the average, centroid and ward
+		 *			linkages, so that each entry stands for its observations at its centroid.
+		 *	@param method The algorithm for computing the distance between clusters.
+		 *	@return A matrix that encodes a tree of hierarchical cluster of the entries, with the Euclidean distance.
+		 */
+		mat linkage(linkage_method method = ward_linkage) const
+		{
+			const mat C = centroids();
+			const uword ne = n_entries();
+			if (ne < 2) return mat(0, 3);
+
+			switch (method) {
+			case single_linkage:
+				return arma_ext::linkage(C, method, euclidean);
+			case centroid_linkage:
+			case median_linkage:
+			case ward_linkage:
+				return linkage_centroids(C, method, &ecnt);
+			default:
+				{
+					vec y = pdist(C);
+					std::vector<uword> w(ecnt.begin(), ecnt.end());
+					linkage_workspace ws;
+					return linkage_nnchain(condensed_distance<double>(y), method, y.memptr(), ws, &w[0]);
+				}
+			}
+		}
+
+		/**
+		 *	@brief	The (0-based) leaf entries that the observations of X descend to, which index the clusters of the entries.
+		 *			The observations with NaN, or before any observation is absorbed, get #n_entries.
+		 */
+		uvec assign(const mat& X) const
+		{
+			uvec E(X.n_rows);
+			E.fill(n_entries());
+			if (n_entries() == 0) return E;
+			if (X.n_cols != n)
+				throw std::invalid_argument("X must have the same number of columns as the chunks.");
+
+			std::vector<double> x(n);
+			for (uword i = 0 ; i < X.n_rows ; i++) {
+				bool valid = true;
+				for (uword d = 0 ; d < n ; d++) {
+					x[d] = X.at(i, d);
+					valid = valid && !(x[d] != x[d]);
+				}
+				if (!valid) continue;
+
+				uword t = root;
+				while (!nodes[t].leaf) t = nearest(nodes[t], &x[0]);
+				E[i] = nearest(nodes[t], &x[0]);
+			}
+			return E;
+		}
+
+#ifndef DOXYGEN
+	private:
+		struct node
+		{
+			bool leaf;
+			std::vector<uword> child;	// entries of a leaf, or nodes
+		};
+
+		double T;
+		uword B, max_entries, n, seen, root;
+		std::vector<node> nodes;
+		std::vector<double> nls, nss, ncnt;	// clustering features of the nodes
+		std::vector<double> els, ess, ecnt;	// clustering features of the leaf entries
+		std::vector<uword> path;
+
+		void clear()
+		{
+			nodes.assign(1, node());
+			nodes[0].leaf = true;
+			nls.assign(n, 0.0); nss.assign(1, 0.0); ncnt.assign(1, 0.0);
+			els.clear(); ess.clear(); ecnt.clear();
+			root = 0;
+		}
+
+		const double* ls(const bool leaf, const uword c) const { return leaf ? &els[c * n] : &nls[c * n]; }
+		double cnt(const bool leaf, const uword c) const { return leaf ? ecnt[c] : ncnt[c]; }
+
+		/// The squared distance from x to the centroid of the child c of a node.
+		double distance(const bool leaf, const uword c, const double* x) const
+		{
+			const double* l = ls(leaf, c);
+			const double w = 1 / cnt(leaf, c);
+			double s = 0;
+			for (uword d = 0 ; d < n ; d++) {
+				const double t = l[d] * w - x[d];
+				s += t * t;
+			}
+			return s;
+		}
+
+		/// The child of the node nearest to x.
+		uword nearest(const node& t, const double* x) const
+		{
+			uword best = t.child[0];
+			double bd = datum::inf;
+			for (uword k = 0 ; k < t.child.size() ; k++) {
+				const double d = distance(t.leaf, t.child[k], x);
+				if (d < bd) { bd = d; best = t.child[k]; }
+			}
+			return best;
+		}
+
+		/// Adds the clustering feature (cnt, ls, ss) to the tree.
+		void add(const double* l, const double c, const double ss)
+		{
+			std::vector<double> x(n);
+			for (uword d = 0 ; d < n ; d++) x[d] = l[d] / c;
+
+			path.clear();
+			uword t = root;
+			while (!nodes[t].leaf) {
+				path.push_back(t);
+				t = nearest(nodes[t], &x[0]);
+			}
+			path.push_back(t);
+
+			// the nearest entry absorbs the feature if its radius stays within the threshold
+			bool absorbed = false;
+			if (!nodes[t].child.empty()) {
+				const uword e = nearest(nodes[t], &x[0]);
+				const double N = ecnt[e] + c;
+				double r = (ess[e] + ss) / N;
+				for (uword d = 0 ; d < n ; d++) {
+					const double z = (els[e * n + d] + l[d]) / N;
+					r -= z * z;
+				}
+				if (r <= T * T) {
+					for (uword d = 0 ; d < n ; d++) els[e * n + d] += l[d];
+					ess[e] += ss;
+					ecnt[e] = N;
+					absorbed = true;
+				}
+			}
+			if (!absorbed) {
+				nodes[t].child.push_back(ecnt.size());
+				els.insert(els.end(), l, l + n);
+				ess.push_back(ss);
+				ecnt.push_back(c);
+			}
+
+			for (uword k = 0 ; k < path.size() ; k++) {
+				const uword p = path[k];
+				for (uword d = 0 ; d < n ; d++) nls[p * n + d] += l[d];
+				nss[p] += ss;
+				ncnt[p] += c;
+			}
+
+			for (uword k = path.size() ; k-- > 0 ; ) {
+				if (nodes[path[k]].child.size() <= B) break;
+				const uword u = split(path[k]);
+				if (k > 0)
+					nodes[path[k - 1]].child.push_back(u);
+				else
+					grow(path[k], u);
+			}
+		}
+
+		/// Splits the node t at the farthest pair of its children, and returns the new node, which the caller attaches to a parent.
+		uword split(const uword t)
+		{
+			const bool leaf = nodes[t].leaf;
+			const std::vector<uword> child = nodes[t].child;
+			const uword nc = child.size();
+
+			std::vector<double> C(nc * n);
+			for (uword k = 0 ; k < nc ; k++)
+				for (uword d = 0 ; d < n ; d++) C[k * n + d] = ls(leaf, child[k])[d] / cnt(leaf, child[k]);
+
+			uword sa = 0, sb = 1;
+			double dmax = -1;
+			for (uword a = 0 ; a < nc ; a++)
+				for (uword b = a + 1 ; b < nc ; b++) {
+					const double d = metric_squaredeuclidean()(&C[a * n], &C[b * n], n);
+					if (d > dmax) { dmax = d; sa = a; sb = b; }
+				}
+
+			const uword u = nodes.size();
+			nodes.push_back(node());
+			nodes[u].leaf = leaf;
+			nls.resize(nls.size() + n); nss.push_back(0); ncnt.push_back(0);
+
+			nodes[t].child.clear();
+			for (uword k = 0 ; k < nc ; k++) {
+				const double da = metric_squaredeuclidean()(&C[k * n], &C[sa * n], n);
+				const double db = metric_squaredeuclidean()(&C[k * n], &C[sb * n], n);
+				const bool to_b = (k == sb) || (k != sa && db < da);
+				nodes[to_b ? u : t].child.push_back(child[k]);
+			}
+
+			summarize(t);
+			summarize(u);
+			return u;
+		}
+
+		/// Makes a new root over the split root t and its new sibling u.
+		void grow(const uword t, const uword u)
+		{
+			const uword r = nodes.size();
+			nodes.push_back(node());
+			nodes[r].leaf = false;
+			nodes[r].child.push_back(t);
+			nodes[r].child.push_back(u);
+			nls.resize(nls.size() + n); nss.push_back(0); ncnt.push_back(0);
+			summarize(r);
+			root = r;
+		}
+
+		/// Sums the clustering features of the children of the node t.
+		void summarize(const uword t)
+		{
+			const node& nd = nodes[t];
+			double* l = &nls[t * n];
+			std::fill(l, l + n, 0.0);
+			nss[t] = ncnt[t] = 0;
+			for (uword k = 0 ; k < nd.child.size() ; k++) {
+				const uword c = nd.child[k];
+				const double* cl = ls(nd.leaf, c);
+				for (uword d = 0 ; d < n ; d++) l[d] += cl[d];
+				nss[t] += nd.leaf ? ess[c] : nss[c];
+				ncnt[t] += cnt(nd.leaf, c);
+			}
+		}
+
+		/// Raises the threshold and reinserts the entries until they are within the limit.
+		void rebuild()
+		{
+			while (n_entries() > max_entries) {
+				// the new threshold merges at least the nearest pairs of entries of the leaves
+				double s = 0;
+				uword c = 0;
+				std::vector<double> z(n);
+				for (uword t = 0 ; t < nodes.size() ; t++) {
+					const node& nd = nodes[t];
+					if (!nd.leaf || nd.child.size() < 2) continue;
+					for (uword k = 0 ; k < nd.child.size() ; k++) {
+						double bd = datum::inf;
+						for (uword d = 0 ; d < n ; d++) z[d] = els[nd.child[k] * n + d] / ecnt[nd.child[k]];
+						for (uword j = 0 ; j < nd.child.size() ; j++)
+							if (j != k) bd = std::min(bd, distance(true, nd.child[j], &z[0]));
+						s += std::sqrt(bd);
+						c++;
+					}
+				}
+				T = std::max(2 * T, c ? s / c : 0.0);
+				if (!(T > 0)) {
+					// the entries coincide, up to rounding, so a threshold relative to the spread of the data merges them
+					double r = nss[root] / ncnt[root];
+					for (uword d = 0 ; d < n ; d++) r -= (nls[root * n + d] / ncnt[root]) * (nls[root * n + d] / ncnt[root]);
+					T = 1e-8 * std::max(std::sqrt(std::max(r, 0.0)), std::sqrt(nss[root] / ncnt[root]));
+					if (!(T > 0)) T = datum::eps;
+				}
+
+				const std::vector<double> ls_(els), ss_(ess), cnt_(ecnt);
+				clear();
+				for (uword e = 0 ; e < cnt_.size() ; e++)
+					add(&ls_[e * n], cnt_[e], ss_[e]);
+			}
+		}
+#endif
+	};
+
+	//!	@}
+
+	//!	@addtogroup	partclust
+	//!	@{
+
+	/**
+	 *	@brief	Options of #kmeans.
+	 */
+	struct kmeans_options
+	{
+		distance_type distance;	///< #squaredeuclidean (or #euclidean) for k-means, or #cosine for spherical k-means
+		uword max_iter;			///< the maximum number of iterations
+		uword replicates;		///< the number of runs from new seeds; the run of the smallest total distance is returned
+
+		kmeans_options() : distance(squaredeuclidean), max_iter(100), replicates(1) {}
+	};
+
+#ifndef DOXYGEN
+	/**
+	 *	Chooses k of the packed observations P as the initial centers C by k-means++: each center is drawn
+	 *	with probability proportional to the squared distance to the nearest center chosen so far.
+	 */
+	inline void kmeans_seed(const mat& P, const uword k, mat& C)
+	{
+		const uword n = P.n_rows, m = P.n_cols;
+		const vec u = randu<vec>(k);
+		std::vector<double> d2(m, datum::inf);
+
+		C.set_size(n, k);
+		uword x = std::min((uword)(u[0] * m), m - 1);
+		std::copy(P.colptr(x), P.colptr(x) + n, C.colptr(0));
+
+		for (uword c = 1 ; c < k ; c++) {
+			const double* z = C.colptr(c - 1);
+
+			ARMA_EXT_PARALLEL_FOR(i, m)
+				d2[i] = std::min(d2[i], metric_squaredeuclidean()(P.colptr(i), z, n));
+			ARMA_EXT_PARALLEL_END
+
+			double total = 0;
+			for (uword i = 0 ; i < m ; i++) total += d2[i];
+
+			if (total > 0) {
+				const double t = u[c] * total;
+				double s = 0;
+				for (x = 0 ; x + 1 < m ; x++) {
+					s += d2[x];
+					if (s >= t && d2[x] > 0) break;
+				}
+				while (d2[x] == 0) x--;	// the rounding of the sum leaves t past the last observation
+			}
+			else
+				x = std::min((uword)(u[c] * m), m - 1);	// fewer distinct observations than centers
+
+			std::copy(P.colptr(x), P.colptr(x) + n, C.colptr(c));
+		}
+	}
+
+	/// Centers of the sums S of the observations of the clusters, and the distance each center moved.
+	inline void kmeans_centers(const mat& S, const std::vector<double>& count, const bool spherical, mat& C, std::vector<double>& drift)
+	{
+		const uword n = S.n_rows, k = S.n_cols;
+		std::vector<double> z(n);
+
+		for (uword c = 0 ; c < k ; c++) {
+			drift[c] = 0;
+			if (count[c] == 0) continue;
+
+			const double* s = S.colptr(c);
+			double w = 1 / count[c];
+			if (spherical) {
+				double q = 0;
+				for (uword d = 0 ; d < n ; d++) q += s[d] * s[d];
+				w = (q > 0) ? 1 / std::sqrt(q) : 0;
+			}
+
+			for (uword d = 0 ; d < n ; d++) z[d] = s[d] * w;
+			if (spherical && w == 0) continue;	// the observations cancel; the center is kept
+
+			double* p = C.colptr(c);
+			drift[c] = metric_euclidean()(p, &z[0], n);
+			std::copy(z.begin(), z.end(), p);
+		}
+	}
+
+	/**
+	 *	Lloyd's algorithm from the centers C on the packed observations P, which finds the 0-based labels a.
+	 *	Each step skips the distances that the triangle inequality bounds: Hamerly's algorithm keeps an upper
+	 *	bound on the distance to the assigned center and a lower bound on the distance to the second nearest,
+	 *	and Elkan's algorithm keeps a lower bound for every center, which prunes more for many centers at
+	 *	the cost of \f$O(mk)\f$ memory. The observations are assigned in parallel, and the sums of the clusters
+	 *	are updated with the observations that moved.
+	 *	For spherical k-means, P holds unit vectors and the centers are normalized.
+	 */
+	inline void kmeans_lloyd(const mat& P, mat& C, std::vector<uword>& a, const bool spherical, const uword max_iter)
+	{
+		const uword n = P.n_rows, m = P.n_cols, k = C.n_cols;
+		const bool elkan = k > 32 && m * k <= (uword(1) << 26);
+		const uword nl = elkan ? k : 1;
+
+		std::vector<uword> b(m);
+		std::vector<double> u(m), l(m * nl), count(k, 0), drift(k), half(k);
+		mat S, CC;
+		S.zeros(n, k);
+		if (elkan) CC.set_size(k, k);
+
+		// the first assignment computes all the distances
+		ARMA_EXT_PARALLEL_FOR(i, m)
+			const double* x = P.colptr(i);
+			double d1 = datum::inf, d2 = datum::inf;
+			uword c1 = 0;
+			for (uword c = 0 ; c < k ; c++) {
+				const double d = metric_euclidean()(x, C.colptr(c), n);
+				if (elkan) l[i * k + c] = d;
+				if (d < d1) { d2 = d1; d1 = d; c1 = c; }
+				else if (d < d2) d2 = d;
+			}
+			a[i] = c1; u[i] = d1;
+			if (!elkan) l[i] = d2;
+		ARMA_EXT_PARALLEL_END
+
+		for (uword i = 0 ; i < m ; i++) {
+			const double* x = P.colptr(i);
+			double* s = S.colptr(a[i]);
+			for (uword d = 0 ; d < n ; d++) s[d] += x[d];
+			count[a[i]]++;
+		}
+
+		uword changed = m;
+		for (uword iter = 0 ; ; iter++) {
+			// an empty cluster takes the observation farthest from its center
+			for (uword c = 0 ; c < k ; c++) {
+				if (count[c] > 0) continue;
+
+				uword f = 0;
+				double fd = -1;
+				for (uword i = 0 ; i < m ; i++) {
+					if (count[a[i]] < 2) continue;
+					const double d = metric_squaredeuclidean()(P.colptr(i), C.colptr(a[i]), n);
+					if (d > fd) { fd = d; f = i; }
+				}
+				if (!(fd > 0)) break;
+
+				const double* x = P.colptr(f);
+				double* so = S.colptr(a[f]);
+				double* sn = S.colptr(c);
+				for (uword d = 0 ; d < n ; d++) { so[d] -= x[d]; sn[d] += x[d]; }
+				count[a[f]]--; count[c]++;
+
+				a[f] = c; u[f] = 0;
+				std::fill(l.begin() + f * nl, l.begin() + (f + 1) * nl, 0.0);
+				changed++;
+			}
+
+			kmeans_centers(S, count, spherical, C, drift);
+
+			// the bounds follow the centers
+			uword cmax = 0;
+			for (uword c = 1 ; c < k ; c++) if (drift[c] > drift[cmax]) cmax = c;
+			double dmax2 = 0;
+			for (uword c = 0 ; c < k ; c++) if (c != cmax) dmax2 = std::max(dmax2, drift[c]);
+
+			ARMA_EXT_PARALLEL_FOR(i, m)
+				u[i] += drift[a[i]];
+				if (elkan) {
+					double* li = &l[i * k];
+					for (uword c = 0 ; c < k ; c++) li[c] = std::max(li[c] - drift[c], 0.0);
+				}
+				else
+					l[i] -= (a[i] == cmax) ? dmax2 : drift[cmax];
+			ARMA_EXT_PARALLEL_END
+
+			if (changed == 0 || iter == max_iter) break;
+
+			// half the distance from each center to the nearest other center
+			ARMA_EXT_PARALLEL_FOR(c, k)
+				double h = datum::inf;
+				for (uword e = 0 ; e < k ; e++) {
+					if (e == c) continue;
+					const double d = 0.5 * metric_euclidean()(C.colptr(c), C.colptr(e), n);
+					if (elkan) CC.at(e, c) = d;
+					h = std::min(h, d);
+				}
+				half[c] = h;
+			ARMA_EXT_PARALLEL_END
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(i, m, 256)
+				const double* x = P.colptr(i);
+				uword ai = a[i];
+				double ui = u[i];
+				b[i] = ai;
+
+				if (elkan) {
+					if (ui > half[ai]) {
+						double* li = &l[i * k];
+						bool tight = false;
+						for (uword c = 0 ; c < k ; c++) {
+							if (c == ai) continue;
+							const double z = std::max(li[c], CC.at(c, ai));
+							if (ui <= z) continue;
+							if (!tight) {
+								ui = li[ai] = metric_euclidean()(x, C.colptr(ai), n);
+								tight = true;
+								if (ui <= std::max(li[c], CC.at(c, ai))) continue;
+							}
+							const double d = li[c] = metric_euclidean()(x, C.colptr(c), n);
+							if (d < ui) { ai = c; ui = d; }
+						}
+						b[i] = ai; u[i] = ui;
+					}
+				}
+				else {
+					const double z = std::max(half[ai], l[i]);
+					if (ui > z) {
+						ui = u[i] = metric_euclidean()(x, C.colptr(ai), n);
+						if (ui > z) {
+							double d1 = datum::inf, d2 = datum::inf;
+							uword c1 = 0;
+							for (uword c = 0 ; c < k ; c++) {
+								const double d = metric_euclidean()(x, C.colptr(c), n);
+								if (d < d1) { d2 = d1; d1 = d; c1 = c; }
+								else if (d < d2) d2 = d;
+							}
+							b[i] = c1; u[i] = d1; l[i] = d2;
+						}
+					}
+				}
+			ARMA_EXT_PARALLEL_END
+
+			changed = 0;
+			for (uword i = 0 ; i < m ; i++) {
+				if (b[i] == a[i]) continue;
+
+				const double* x = P.colptr(i);
+				double* so = S.colptr(a[i]);
+				double* sn = S.colptr(b[i]);
+				for (uword d = 0 ; d < n ; d++) { so[d] -= x[d]; sn[d] += x[d]; }
+				count[a[i]]--; count[b[i]]++;
+				a[i] = b[i];
+				changed++;
+			}
+		}
+	}
+
+	/// Packs the rows of X without NaN as contiguous observations; rows holds the row of each observation.
+	inline mat kmeans_pack(const mat& X, std::vector<uword>& rows)
+	{
+		const uword n = X.n_cols;
+		rows.clear();
+		for (uword i = 0 ; i < X.n_rows ; i++) {
+			bool valid = true;
+			for (uword d = 0 ; d < n ; d++) valid = valid && !(X.at(i, d) != X.at(i, d));
+			if (valid) rows.push_back(i);
+		}
+
+		mat P(n, rows.size());
+		for (uword j = 0 ; j < rows.size() ; j++)
+			for (uword d = 0 ; d < n ; d++) P.at(d, j) = X.at(rows[j], d);
+		return P;
+	}
+#endif
+
+	/**
+	 *	@brief	k-means clustering.<br>
+	 *			Partitions the observations into k clusters which minimize the sum of the distances of the
+	 *			observations to the centers of their clusters. The centers are seeded by k-means++.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix. The observations with NaN are not clustered.
+	 *	@param k	The number of clusters.
+	 *	@param C	The \f$k\f$-by-\f$n\f$ matrix of the centers.
+	 *	@param sumd	The sum of the distances of the observations of each cluster to its center.
+	 *				For #cosine, the distance is \f$1 - \cos\f$; otherwise it is the squared Euclidean distance.
+	 *	@param opts	The options.
+	 *	@return	The cluster indices (1-based) of the observations; 0 for the observations with NaN.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/kmeans.html
+	 *	@note	The steps of Lloyd's algorithm skip the distances bounded by the triangle inequality, by the
+	 *			algorithm of Hamerly for \f$k \le 32\f$ and of Elkan otherwise, and assign the observations in parallel.
+	 */
+	inline uvec kmeans(const mat& X, uword k, mat& C, vec& sumd, const kmeans_options& opts = kmeans_options())
+	{
+		const uword n = X.n_cols;
+
+		bool spherical = false;
+		switch (opts.distance) {
+		case squaredeuclidean:
+		case euclidean:
+			break;
+		case cosine:
+			spherical = true;
+			break;
+		default:
+			throw std::invalid_argument("Unsupported distance type.");
+		}
+
+		std::vector<uword> rows;
+		mat P = kmeans_pack(X, rows);
+
+		const uword m = rows.size();
+		if (k == 0 || k > m)
+			throw std::invalid_argument("The number of clusters must be positive and at most the number of observations.");
+
+		if (spherical)
+			for (uword j = 0 ; j < m ; j++) {
+				double* p = P.colptr(j);
+				double q = 0;
+				for (uword d = 0 ; d < n ; d++) q += p[d] * p[d];
+				if (!(q > 0))
+					throw std::invalid_argument("The observations must not be zero for the cosine distance.");
+				q = 1 / std::sqrt(q);
+				for (uword d = 0 ; d < n ; d++) p[d] *= q;
+			}
+
+		std::vector<uword> a(m), best;
+		mat Cr, Cbest;
+		vec sr(k);
+		double total = datum::inf;
+
+		for (uword r = 0 ; r < std::max<uword>(opts.replicates, 1) ; r++) {
+			kmeans_seed(P, k, Cr);
+			kmeans_lloyd(P, Cr, a, spherical, opts.max_iter);
+
+			sr.zeros();
+			for (uword i = 0 ; i < m ; i++) {
+				const double d = metric_squaredeuclidean()(P.colptr(i), Cr.colptr(a[i]), n);
+				sr[a[i]] += spherical ? d / 2 : d;
+			}
+
+			double t = 0;
+			for (uword c = 0 ; c < k ; c++) t += sr[c];
+			if (t < total || best.empty()) {
+				total = t;
+				best = a;
+				Cbest = Cr;
+				sumd = sr;
+			}
+		}
+
+		C = trans(Cbest);
+
+		uvec T(X.n_rows);
+		T.zeros();
+		for (uword j = 0 ; j < m ; j++) T[rows[j]] = best[j] + 1;
+		return T;
+	}
+
+	/**
+	 *	@brief	k-means clustering.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param k	The number of clusters.
+	 *	@param C	The \f$k\f$-by-\f$n\f$ matrix of the centers.
+	 *	@param opts	The options.
+	 *	@return	The cluster indices (1-based) of the observations.
+	 *	@see	kmeans(const mat&, uword, mat&, vec&, const kmeans_options&)
+	 */
+	inline uvec kmeans(const mat& X, uword k, mat& C, const kmeans_options& opts = kmeans_options())
+	{
+		vec sumd;
+		return kmeans(X, k, C, sumd, opts);
+	}
+
+	/**
+	 *	@brief	k-means clustering.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param k	The number of clusters.
+	 *	@param opts	The options.
+	 *	@return	The cluster indices (1-based) of the observations.
+	 *	@see	kmeans(const mat&, uword, mat&, vec&, const kmeans_options&)
+	 */
+	inline uvec kmeans(const mat& X, uword k, const kmeans_options& opts = kmeans_options())
+	{
+		mat C;
+		vec sumd;
+		return kmeans(X, k, C, sumd, opts);
+	}
+
+	/**
+	 *	@brief	Streaming (mini-batch) k-means.<br>
+	 *			The observations are ingested in chunks, which are clustered against the current centers and
+	 *			then discarded. Each center moves to the mean of all the observations ever assigned to it, that is,
+	 *			by the learning rate \f$b_c / (n_c + b_c)\f$ of its \f$n_c\f$ past and \f$b_c\f$ new observations.
+	 *			The centers are seeded by k-means++ from the first k observations or more.
+	 *	@note	The buffers grow to the largest chunk and are reused, so ingesting allocates no memory afterwards.
+	 *			The observations of a chunk are assigned in parallel.
+	 */
+	class streaming_kmeans
+	{
+	public:
+		/**
+		 *	@brief	Creates an empty model.
+		 *	@param k_			The number of clusters.
+		 *	@param distance_	#squaredeuclidean (or #euclidean) for k-means, or #cosine for spherical k-means.
+		 */
+		streaming_kmeans(const uword k_ = 0, const distance_type distance_ = squaredeuclidean)
+			: k(k_), n(0), seen(0), distance(distance_)
+		{
+			if (distance != squaredeuclidean && distance != euclidean && distance != cosine)
+				throw std::invalid_argument("Unsupported distance type.");
+		}
+
+		/**
+		 *	@brief	Updates the centers with the observations (rows) of a chunk. The observations with NaN are skipped.
+		 */
+		void ingest(const mat& X)
+		{
+			if (k == 0)
+				throw std::invalid_argument("The number of clusters must be positive.");
+			if (X.n_cols == 0)
+				throw std::invalid_argument("The chunk must have at least one column.");
+			if (n == 0) n = X.n_cols;
+			if (X.n_cols != n)
+				throw std::invalid_argument("The chunk must have the same number of columns as the previous chunks.");
+
+			const uword m = pack(X, chunk);
+
+			if (C.n_cols < k) {
+				// the observations are kept until there are enough to seed the centers
+				pending.insert(pending.end(), chunk.begin(), chunk.begin() + m * n);
+				if (pending.size() < k * n) return;
+
+				const mat P(&pending[0], n, pending.size() / n, false);
+				kmeans_seed(P, k, C);
+				counts.zeros(k);
+				update(&pending[0], pending.size() / n);
+				std::vector<double>().swap(pending);
+				return;
 			}
-			*s++ = (no_squared_input) ? t1 : sqrt(t1);
 
-			/* Updates obs-branch pointers "obp" */
-			obp[k] = obp[bc];        /* new cluster branch ptr */
-			obp[l] = bp;             /* leftmost column cluster branch ptr */
+			if (m > 0) update(&chunk[0], m);
+		}
 
-			/*
-			Merges two observations/clusters ("k" and "l") by re-calculating new
-			distances for every remaining observation/cluster and place the
-			information in the row/col "l" */
+		/**
+		 *	@brief	The cluster indices (1-based) of the observations of X; 0 for the observations with NaN.
+		 */
+		uvec predict(const mat& X) const
+		{
+			if (C.n_cols < k)
+				throw std::runtime_error("The centers are not seeded yet.");
+			if (X.n_cols != n)
+				throw std::invalid_argument("X must have the same number of columns as the chunks.");
 
-			/*
+			std::vector<double> P;
+			std::vector<uword> rows, a;
+			const uword m = pack(X, P, &rows);
+			if (m > 0) assign(&P[0], m, a);
 
-			example:  bc=2  k=5  l=8   bn=11   m=12
+			uvec T(X.n_rows);
+			T.zeros();
+			for (uword j = 0 ; j < m ; j++) T[rows[j]] = a[j] + 1;
+			return T;
+		}
 
-			0
-			1    N                             Pairwise
-			2    N   N                         Distance
-			3    N   N   Y                     Half Matrix
-			4    N   N   Y   Y
-			5    N   N  p1*  *   *
-			6    N   N   Y   Y   Y   +
-			7    N   N   Y   Y   Y   +   Y
-			8    N   N  p2*  *   *   []  +   +
-			9    N   N   Y   Y   Y   o   Y   Y   o
-			10   N   N   Y   Y   Y   o   Y   Y   o   Y
-			11   N   N   Y   Y   Y   o   Y   Y   o   Y   Y
+		/// The \f$k\f$-by-\f$n\f$ matrix of the centers.
+		mat centers() const { return trans(C); }
 
-			0   1   2   3   4   5   6   7   8   9   10   11
+		/// The number of observations assigned to each center.
+		const vec& count() const { return counts; }
 
+		/// The number of observations ingested, including those buffered until the centers are seeded.
+		uword n_seen() const { return seen + (n > 0 ? pending.size() / n : 0); }
 
-			p1 is the initial pointer for the kth row-col
-			p2 is the initial pointer for the lth row-col
-			*  are the samples touched in the first loop
-			+  are the samples touched in the second loop
-			o  are the samples touched in the third loop
-			N  is the part of the whole half matrix which is no longer used
-			Y  are all the other samples (not touched)
+		/**
+		 *	@brief	Writes a checkpoint of the model, from which #load resumes.
+		 */
+		void save(const std::string& filename) const
+		{
+			std::ofstream os(filename.c_str(), std::ios::binary);
+			const u64 header[5] = { 0x534b4d45414e5331ULL, k, n, seen, (u64)distance };
+			os.write(reinterpret_cast<const char*>(header), sizeof(header));
+			write(os, C.n_cols);
+			if (C.n_cols == k) {
+				os.write(reinterpret_cast<const char*>(C.memptr()), C.n_elem * sizeof(double));
+				os.write(reinterpret_cast<const char*>(counts.memptr()), k * sizeof(double));
+			}
+			else {
+				write(os, pending.size());
+				if (!pending.empty()) os.write(reinterpret_cast<const char*>(&pending[0]), pending.size() * sizeof(double));
+			}
 
-			*/
+			if (!os)
+				throw std::runtime_error("Failed to write the checkpoint " + filename + ".");
+		}
 
-			/* computing some limit constants to set up the 3-loops to
-			transverse Y */
-			q1 = bn - k - 1;
-			q2 = bn - l - 1;
+		/**
+		 *	@brief	Restores the model from a checkpoint written by #save.
+		 */
+		void load(const std::string& filename)
+		{
+			std::ifstream is(filename.c_str(), std::ios::binary);
+			u64 header[5];
+			is.read(reinterpret_cast<char*>(header), sizeof(header));
+			if (!is || header[0] != 0x534b4d45414e5331ULL)
+				throw std::runtime_error("Failed to read the checkpoint " + filename + ".");
 
-			/* initial pointers to the "k" and  "l" entries in the remaining half
-			matrix */
-			p1 = (((m2m1 - bc) * bc) >> 1) + k - bc - 1;
-			p2 = p1 - k + l;
+			if (header[4] != (u64)squaredeuclidean && header[4] != (u64)euclidean && header[4] != (u64)cosine)
+				throw std::runtime_error("The checkpoint " + filename + " has an unsupported distance type.");
+			const uword k_ = (uword)header[1], n_ = (uword)header[2];
+			const distance_type distance_ = (distance_type)header[4];
 
-			if (uses_scl) {
-				/* Get the cluster cardinalities  */
-				nk     = scl[k];
-				nl     = scl[l];
-				nkpnl  = nk + nl;
+			// the centers are either seeded, or the buffered observations are fewer than k
+			const uword nc = read(is);
+			if (!is || (nc != 0 && nc != k_) || (nc > 0 && n_ == 0))
+				throw std::runtime_error("The checkpoint " + filename + " is corrupt.");
 
-				/* Updates cluster cardinality "scl" */
-				scl[k] = scl[bc];        /* letfmost column cluster cardinality */
-				scl[l] = nkpnl;          /* new cluster cardinality */
+			mat C_;
+			vec counts_;
+			std::vector<double> pending_;
+			if (nc > 0) {
+				C_.set_size(n_, k_);
+				counts_.set_size(k_);
+				is.read(reinterpret_cast<char*>(C_.memptr()), C_.n_elem * sizeof(double));
+				is.read(reinterpret_cast<char*>(counts_.memptr()), k_ * sizeof(double));
+			}
+			else {
+				const uword np = read(is);
+				if (!is || (np > 0 && (n_ == 0 || np % n_ != 0 || np / n_ >= k_)))
+					throw std::runtime_error("The checkpoint " + filename + " is corrupt.");
+				pending_.resize(np);
+				if (np > 0) is.read(reinterpret_cast<char*>(&pending_[0]), np * sizeof(double));
+			}
 
-			} /* if (uses_scl) */
+			if (!is)
+				throw std::runtime_error("Failed to read the checkpoint " + filename + ".");
 
-			/* some other values that we want to compute outside the loops */
-			switch (method_key) {
-			case centroid:
-				t1 = t1 * ((TEMPL) nk * (TEMPL) nl) / ((TEMPL) nkpnl * (TEMPL) nkpnl);
-				break;
-			case average:
-				/* Computes weighting ratios */
-				rnk = (TEMPL) nk / (TEMPL) nkpnl;
-				rnl = (TEMPL) nl / (TEMPL) nkpnl;
-				break;
-			case median:
-				t1 = t1/4;
-                break;
-            default:
-                break;
-			} /* switch (method_key) */
+			k = k_; n = n_; seen = (uword)header[3];
+			distance = distance_;
+			C.swap(C_);
+			counts.swap(counts_);
+			pending.swap(pending_);
+		}
 
-			switch (method_key) {
-			case average:
-				for (q=bn-bc-1; q>q1; q--) {
-					t2 = y[p1] * rnk + y[p2] * rnl;
-					if (t2 < t3) t3 = t2 ;
-					y[p2] = t2;
-					p1 = p1 + q;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2 = p2 + q;
-				for (q=q1-1;  q>q2; q--) {
-					t2 = y[p1] * rnk + y[p2] * rnl;
-					if (t2 < t3) t3 = t2 ;
-					y[p2] = t2;
-					p1++;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2++;
-				for (q=q2+1; q>0; q--) {
-					t2 = y[p1] * rnk + y[p2] * rnl;
-					if (t2 < t3) t3 = t2 ;
-					y[p2] = t2;
-					p1++;
-					p2++;
-				}
-				break; /* case average */
+#ifndef DOXYGEN
+	private:
+		uword k, n, seen;
+		distance_type distance;
+		mat C;							// packed centers
+		vec counts;						// observations assigned to each center
+		std::vector<double> chunk;		// packed observations of the chunk
+		std::vector<double> pending;	// packed observations before the centers are seeded
+		std::vector<uword> labels;		// centers of the observations of the chunk
+		std::vector<double> sums;		// sums of the observations of the chunk for each center
+		std::vector<double> batch;		// observations of the chunk for each center
 
-			case single:
-				for (q=bn-bc-1; q>q1; q--) {
-					if (y[p1] < y[p2]) y[p2] = y[p1];
-					else if (ISNAN_(y[p2])) y[p2] = y[p1];
-					if (y[p2] < t3)    t3 = y[p2];
-					p1 = p1 + q;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2 = p2 + q;
-				for (q=q1-1;  q>q2; q--) {
-					if (y[p1] < y[p2]) y[p2] = y[p1];
-					else if (ISNAN_(y[p2])) y[p2] = y[p1];
-					if (y[p2] < t3)    t3 = y[p2];
-					p1++;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2++;
-				for (q=q2+1; q>0; q--) {
-					if (y[p1] < y[p2]) y[p2] = y[p1];
-					else if (ISNAN_(y[p2])) y[p2] = y[p1];
-					if (y[p2] < t3)    t3 = y[p2];
-					p1++;
-					p2++;
-				}
-				break; /* case simple */
+		static void write(std::ostream& os, const u64 v) { os.write(reinterpret_cast<const char*>(&v), sizeof(v)); }
+		static uword read(std::istream& is) { u64 v = 0; is.read(reinterpret_cast<char*>(&v), sizeof(v)); return (uword)v; }
 
-			case complete:
-				for (q=bn-bc-1; q>q1; q--) {
-					if (y[p1] > y[p2]) y[p2] = y[p1];
-					else if (ISNAN_(y[p2])) y[p2] = y[p1];
-					if (y[p2] < t3)    t3 = y[p2];
-					p1 = p1 + q;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2 = p2 + q;
-				for (q=q1-1;  q>q2; q--) {
-					if (y[p1] > y[p2]) y[p2] = y[p1];
-					else if (ISNAN_(y[p2])) y[p2] = y[p1];
-					if (y[p2] < t3)    t3 = y[p2];
-					p1++;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2++;
-				for (q=q2+1; q>0; q--) {
-					if (y[p1] > y[p2]) y[p2] = y[p1];
-					else if (ISNAN_(y[p2])) y[p2] = y[p1];
-					if (y[p2] < t3)    t3 = y[p2];
-					p1++;
-					p2++;
-				}
-				break; /* case complete */
+		/// Packs the rows of X without NaN as contiguous observations, normalized for the cosine distance.
+		uword pack(const mat& X, std::vector<double>& P, std::vector<uword>* rows = nullptr) const
+		{
+			if (P.size() < X.n_elem) P.resize(X.n_elem);
 
-			case weighted:
-				for (q=bn-bc-1; q>q1; q--) {
-					t2 = (y[p1] + y[p2])/2;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1 = p1 + q;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2 = p2 + q;
-				for (q=q1-1;  q>q2; q--) {
-					t2 = (y[p1] + y[p2])/2;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2 = p2 + q;
-				}
-				p1++;
-				p2++;
-				for (q=q2+1; q>0; q--) {
-					t2 = (y[p1] + y[p2])/2;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2++;
+			uword m = 0;
+			for (uword i = 0 ; i < X.n_rows ; i++) {
+				double* p = &P[0] + m * n;
+				double q = 0;
+				bool valid = true;
+				for (uword d = 0 ; d < n ; d++) {
+					p[d] = X.at(i, d);
+					valid = valid && !(p[d] != p[d]);
+					q += p[d] * p[d];
 				}
-				break; /* case weighted */
+				if (!valid) continue;
 
-			case centroid:
-				for (q=bn-bc-1; q>q1; q--) {
-					t2 = y[p1] * rnk + y[p2] * rnl - t1;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1 = p1 + q;
-					p2 = p2 + q;
+				if (distance == cosine) {
+					if (!(q > 0)) continue;
+					q = 1 / std::sqrt(q);
+					for (uword d = 0 ; d < n ; d++) p[d] *= q;
 				}
-				p1++;
-				p2 = p2 + q;
-				for (q=q1-1;  q>q2; q--) {
-					t2 = y[p1] * rnk + y[p2] * rnl - t1;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2 = p2 + q;
+
+				if (rows) rows->push_back(i);
+				m++;
+			}
+			return m;
+		}
+
+		/// Assigns the m packed observations P to the nearest centers.
+		void assign(const double* P, const uword m, std::vector<uword>& a) const
+		{
+			if (a.size() < m) a.resize(m);
+
+			ARMA_EXT_PARALLEL_FOR(i, m)
+				const double* x = P + i * n;
+				double best = datum::inf;
+				uword c1 = 0;
+				for (uword c = 0 ; c < k ; c++) {
+					const double d = metric_squaredeuclidean()(x, C.colptr(c), n);
+					if (d < best) { best = d; c1 = c; }
 				}
-				p1++;
-				p2++;
-				for (q=q2+1; q>0; q--) {
-					t2 = y[p1] * rnk + y[p2] * rnl - t1;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2++;
+				a[i] = c1;
+			ARMA_EXT_PARALLEL_END
+		}
+
+		/// Moves each center to the mean of its past and new observations.
+		void update(const double* P, const uword m)
+		{
+			assign(P, m, labels);
+
+			sums.assign(n * k, 0.0);
+			batch.assign(k, 0.0);
+			for (uword i = 0 ; i < m ; i++) {
+				const double* x = P + i * n;
+				double* s = &sums[labels[i] * n];
+				for (uword d = 0 ; d < n ; d++) s[d] += x[d];
+				batch[labels[i]]++;
+			}
+
+			for (uword c = 0 ; c < k ; c++) {
+				if (batch[c] == 0) continue;
+
+				counts[c] += batch[c];
+				const double eta = 1 / counts[c];
+				const double* s = &sums[c * n];
+				double* z = C.colptr(c);
+				double q = 0;
+				for (uword d = 0 ; d < n ; d++) {
+					z[d] += eta * (s[d] - batch[c] * z[d]);
+					q += z[d] * z[d];
 				}
-				break; /* case centroid */
 
-			case median:
-				for (q=bn-bc-1; q>q1; q--) {
-					t2 = (y[p1] + y[p2])/2 - t1;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1 = p1 + q;
-					p2 = p2 + q;
+				if (distance == cosine && q > 0) {
+					q = 1 / std::sqrt(q);
+					for (uword d = 0 ; d < n ; d++) z[d] *= q;
 				}
-				p1++;
-				p2 = p2 + q;
-				for (q=q1-1;  q>q2; q--) {
-					t2 = (y[p1] + y[p2])/2 - t1;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2 = p2 + q;
+			}
+
+			seen += m;
+		}
+#endif
+	};
+
+	/**
+	 *	@brief	Covariance structure of the components of a Gaussian mixture.
+	 */
+#ifdef ARMA_EXT_USE_CPP11
+	enum covariance_type : uword
+#else
+	enum covariance_type
+#endif
+	{
+		full_covariance,		///< Any covariance matrix.
+		diagonal_covariance,	///< Diagonal covariance matrix.
+		spherical_covariance	///< Scaled identity matrix.
+	};
+
+	/**
+	 *	@brief	Options of #fitgmm.
+	 */
+	struct gmm_options
+	{
+		covariance_type covariance;	///< the covariance structure of the components
+		uword max_iter;				///< the maximum number of EM iterations
+		double tolerance;			///< the relative change of the log-likelihood at which EM stops
+		double regularization;		///< the value added to the diagonal of the covariance matrices
+		uvec start;					///< the initial cluster indices (1-based; 0 to skip) of the observations, such as of #kmeans or #cluster; by #kmeans if empty
+
+		gmm_options() : covariance(full_covariance), max_iter(100), tolerance(1e-6), regularization(0) {}
+	};
+
+#ifndef DOXYGEN
+	/**
+	 *	Cached factors of the components: the inverse W of the lower Cholesky factor of each covariance matrix
+	 *	(or the inverse standard deviations of a diagonal one), and the constant of each log-density.
+	 */
+	struct gmm_factors
+	{
+		std::vector<mat> W;	// full: inverse lower Cholesky factors
+		mat isd;			// diagonal and spherical: inverse standard deviations, n-by-k
+		mat Wmu;			// full: W * mu, n-by-k
+		vec logc;			// log weight - log det / 2 - n log(2 pi) / 2
+
+		void build(const mat& mu, const cube& sigma, const vec& weights, const covariance_type covariance)
+		{
+			const uword n = mu.n_rows, k = mu.n_cols;
+			const double log2pi = std::log(2 * datum::pi);
+			logc.set_size(k);
+
+			if (covariance == full_covariance) {
+				W.resize(k);
+				Wmu.set_size(n, k);
+			}
+			else
+				isd.set_size(n, k);
+
+			for (uword c = 0 ; c < k ; c++) {
+				double logdet = 0;
+				if (covariance == full_covariance) {
+					mat R;
+					if (!chol(R, sigma.slice(c)))
+						throw std::runtime_error("The covariance matrix of a component is not positive definite; increase the regularization.");
+					for (uword d = 0 ; d < n ; d++) logdet += 2 * std::log(R.at(d, d));
+
+					W[c] = solve(trimatl(trans(R)), eye<mat>(n, n));
+					const vec wm = W[c] * mu.col(c);
+					std::copy(wm.memptr(), wm.memptr() + n, Wmu.colptr(c));
 				}
-				p1++;
-				p2++;
-				for (q=q2+1; q>0; q--) {
-					t2 = (y[p1] + y[p2])/2 - t1;
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2++;
+				else {
+					for (uword d = 0 ; d < n ; d++) {
+						const double v = sigma.slice(c).at(d, d);
+						if (!(v > 0))
+							throw std::runtime_error("The covariance matrix of a component is not positive definite; increase the regularization.");
+						logdet += std::log(v);
+						isd.at(d, c) = 1 / std::sqrt(v);
+					}
 				}
-				break; /* case median */
+				logc[c] = std::log(weights[c]) - 0.5 * logdet - 0.5 * n * log2pi;
+			}
+		}
+	};
 
-			case ward:
-				for (q=bn-bc-1,g=bc; q>q1; q--) {
-					ng = scl[g++];
-					t2 = (y[p1]*(nk+ng) + y[p2]*(nl+ng) - t1*ng) / (nkpnl+ng);
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1 = p1 + q;
-					p2 = p2 + q;
+	/**
+	 *	E-step: the responsibilities R (k-by-m) of the components for the packed observations P, and the
+	 *	log-likelihood of each observation in lse, computed in log-space. The observations are processed in
+	 *	blocks in parallel, and the Mahalanobis distances of a block to a component with a full covariance
+	 *	matrix are computed by a single matrix product with the inverse Cholesky factor.
+	 */
+	inline void gmm_estep(const mat& P, const mat& mu, const gmm_factors& F, const covariance_type covariance, mat& R, vec& lse)
+	{
+		const uword n = P.n_rows, m = P.n_cols, k = mu.n_cols;
+		const uword bs = 256;
+		const uword nb = (m + bs - 1) / bs;
+		R.set_size(k, m);
+		lse.set_size(m);
+
+		ARMA_EXT_PARALLEL_FOR_DYNAMIC(b, nb, 1)
+			const uword i0 = b * bs, i1 = std::min(i0 + bs, m), nbk = i1 - i0;
+			const mat Pb(const_cast<double*>(P.colptr(i0)), n, nbk, false);
+
+			for (uword c = 0 ; c < k ; c++) {
+				if (covariance == full_covariance) {
+					const mat Z = F.W[c] * Pb;
+					const double* wm = F.Wmu.colptr(c);
+					for (uword i = 0 ; i < nbk ; i++)
+						R.at(c, i0 + i) = F.logc[c] - 0.5 * metric_squaredeuclidean()(Z.colptr(i), wm, n);
 				}
-				g++;
-				p1++;
-				p2 = p2 + q;
-				for (q=q1-1;  q>q2; q--) {
-					ng = scl[g++];
-					t2 = (y[p1]*(nk+ng) + y[p2]*(nl+ng) - t1*ng) / (nkpnl+ng);
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2 = p2 + q;
+				else {
+					const double* z = mu.colptr(c);
+					const double* w = F.isd.colptr(c);
+					for (uword i = 0 ; i < nbk ; i++) {
+						const double* x = Pb.colptr(i);
+						double q = 0;
+						for (uword d = 0 ; d < n ; d++) {
+							const double t = (x[d] - z[d]) * w[d];
+							q += t * t;
+						}
+						R.at(c, i0 + i) = F.logc[c] - 0.5 * q;
+					}
 				}
-				g++;
-				p1++;
-				p2++;
-				for (q=q2+1; q>0; q--) {
-					ng = scl[g++];
-					t2 = (y[p1]*(nk+ng) + y[p2]*(nl+ng) - t1*ng) / (nkpnl+ng);
-					if (t2<t3) t3=t2;
-					y[p2] = t2;
-					p1++;
-					p2++;
+			}
+
+			for (uword i = i0 ; i < i1 ; i++) {
+				double* r = R.colptr(i);
+				double top = -datum::inf;
+				for (uword c = 0 ; c < k ; c++) top = std::max(top, r[c]);
+
+				double s = 0;
+				for (uword c = 0 ; c < k ; c++) s += std::exp(r[c] - top);
+				lse[i] = top + std::log(s);
+				for (uword c = 0 ; c < k ; c++) r[c] = std::exp(r[c] - lse[i]);
+			}
+		ARMA_EXT_PARALLEL_END
+	}
+
+	/**
+	 *	M-step: the weights, means and covariance matrices of the components from the responsibilities R.
+	 *	The means are a single matrix product, and the covariance matrix of each component is accumulated from
+	 *	blocks of the centered observations scaled by the square roots of the responsibilities. The components
+	 *	are processed in parallel.
+	 */
+	inline void gmm_mstep(const mat& P, const mat& R, const covariance_type covariance, const double regularization,
+		mat& mu, cube& sigma, vec& weights)
+	{
+		const uword n = P.n_rows, m = P.n_cols, k = R.n_rows;
+		const uword bs = 1024;
+
+		vec nk(k);
+		nk.zeros();
+		for (uword i = 0 ; i < m ; i++) {
+			const double* r = R.colptr(i);
+			for (uword c = 0 ; c < k ; c++) nk[c] += r[c];
+		}
+		for (uword c = 0 ; c < k ; c++)
+			if (!(nk[c] > 0))
+				throw std::runtime_error("A component has no observations; reduce the number of components.");
+
+		weights = nk / accu(nk);
+		mu = P * trans(R);
+		for (uword c = 0 ; c < k ; c++) {
+			double* z = mu.colptr(c);
+			for (uword d = 0 ; d < n ; d++) z[d] /= nk[c];
+		}
+
+		sigma.set_size(n, n, k);
+
+		ARMA_EXT_PARALLEL_FOR_DYNAMIC(c, k, 1)
+			const double* z = mu.colptr(c);
+			mat& S = sigma.slice(c);
+			S.zeros(n, n);
+
+			if (covariance == full_covariance) {
+				mat Q(n, bs);
+				for (uword i0 = 0 ; i0 < m ; i0 += bs) {
+					const uword i1 = std::min(i0 + bs, m);
+					if (i1 - i0 < bs) Q.set_size(n, i1 - i0);
+					for (uword i = i0 ; i < i1 ; i++) {
+						const double* x = P.colptr(i);
+						double* q = Q.colptr(i - i0);
+						const double w = std::sqrt(R.at(c, i));
+						for (uword d = 0 ; d < n ; d++) q[d] = w * (x[d] - z[d]);
+					}
+					S += Q * trans(Q);
+				}
+				S /= nk[c];
+				S = 0.5 * (S + trans(S));
+			}
+			else {
+				for (uword i = 0 ; i < m ; i++) {
+					const double* x = P.colptr(i);
+					const double w = R.at(c, i);
+					for (uword d = 0 ; d < n ; d++) S.at(d, d) += w * (x[d] - z[d]) * (x[d] - z[d]);
 				}
-				break; /* case ward */
+				double t = 0;
+				for (uword d = 0 ; d < n ; d++) t += (S.at(d, d) /= nk[c]);
+				if (covariance == spherical_covariance)
+					for (uword d = 0 ; d < n ; d++) S.at(d, d) = t / n;
+			}
 
-			} /* switch (method_key) */
+			for (uword d = 0 ; d < n ; d++) S.at(d, d) += regularization;
+		ARMA_EXT_PARALLEL_END
+	}
+#endif
 
-			/*
-			moves the leftmost column "bc" to row/col "k" */
-			if (k!=bc) {
-				q1 = bn - k;
+	/**
+	 *	@brief	Gaussian mixture model, as fitted by #fitgmm.
+	 */
+	struct gmm_model
+	{
+		mat mu;						///< the \f$k\f$-by-\f$n\f$ matrix of the means of the components
+		cube sigma;					///< the \f$n\f$-by-\f$n\f$-by-\f$k\f$ covariance matrices of the components
+		vec weights;				///< the mixing proportions of the components
+		covariance_type covariance;	///< the covariance structure of the components
+		double loglik;				///< the log-likelihood of the observations
+		uword iterations;			///< the number of EM iterations
+		bool converged;				///< whether the log-likelihood converged within the maximum number of iterations
 
-				p1 = (((m2m3 - bc) * bc) >> 1) + k - 1;
-				p2 = p1 - k + bc + 1;
+		/**
+		 *	@brief	The posterior probabilities of the components given the observations.
+		 *	@return	The \f$m\f$-by-\f$k\f$ matrix of the probabilities; NaN for the observations with NaN.
+		 */
+		mat posterior(const mat& X) const
+		{
+			if (X.n_cols != mu.n_cols)
+				throw std::invalid_argument("X must have the same number of columns as the means.");
 
-				for (q=bn-bc-1; q>q1; q--) {
-					p1 = p1 + q;
-					y[p1] = y[p2++];
+			std::vector<uword> rows;
+			const mat P = kmeans_pack(X, rows);
+			const mat M = trans(mu);
+
+			gmm_factors F;
+			F.build(M, sigma, weights, covariance);
+
+			mat R;
+			vec lse;
+			gmm_estep(P, M, F, covariance, R, lse);
+
+			mat out(X.n_rows, mu.n_rows);
+			out.fill(datum::nan);
+			for (uword j = 0 ; j < rows.size() ; j++)
+				for (uword c = 0 ; c < mu.n_rows ; c++) out.at(rows[j], c) = R.at(c, j);
+			return out;
+		}
+
+		/**
+		 *	@brief	The cluster indices (1-based) of the components of the largest posterior probabilities; 0 for the observations with NaN.
+		 */
+		uvec cluster(const mat& X) const
+		{
+			const mat Q = posterior(X);
+			uvec T(X.n_rows);
+			for (uword i = 0 ; i < X.n_rows ; i++) {
+				T[i] = 0;
+				double best = -1;
+				for (uword c = 0 ; c < Q.n_cols ; c++)
+					if (Q.at(i, c) > best) { best = Q.at(i, c); T[i] = c + 1; }
+			}
+			return T;
+		}
+	};
+
+	/**
+	 *	@brief	Fits a Gaussian mixture model by the expectation-maximization (EM) algorithm.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix. The observations with NaN are not used.
+	 *	@param k	The number of components.
+	 *	@param opts	The options.
+	 *	@return	The fitted model.
+	 *	@see	http://www.mathworks.com/help/stats/fitgmdist.html
+	 *	@note	The E-step computes the responsibilities in log-space in parallel blocks of observations with the
+	 *			cached Cholesky factors, and the M-step accumulates the covariance matrices by blocked matrix products.
+	 */
+	inline gmm_model fitgmm(const mat& X, uword k, const gmm_options& opts = gmm_options())
+	{
+		std::vector<uword> rows;
+		const mat P = kmeans_pack(X, rows);
+		const uword m = P.n_cols;
+
+		if (k == 0 || k > m)
+			throw std::invalid_argument("The number of components must be positive and at most the number of observations.");
+
+		const uvec start = opts.start.n_elem ? opts.start : kmeans(X, k);
+		if (start.n_elem != X.n_rows)
+			throw std::invalid_argument("The initial cluster indices must have one element per observation.");
+
+		// the initial responsibilities are the clusters
+		mat R(k, m);
+		R.zeros();
+		for (uword j = 0 ; j < m ; j++) {
+			const uword c = start[rows[j]];
+			if (c > k)
+				throw std::invalid_argument("The initial cluster indices must be at most the number of components.");
+			if (c > 0) R.at(c - 1, j) = 1;
+		}
+
+		gmm_model g;
+		g.covariance = opts.covariance;
+		g.loglik = -datum::inf;
+		g.converged = false;
+
+		mat M;
+		vec lse;
+		gmm_factors F;
+
+		for (g.iterations = 1 ; ; g.iterations++) {
+			gmm_mstep(P, R, opts.covariance, opts.regularization, M, g.sigma, g.weights);
+			F.build(M, g.sigma, g.weights, opts.covariance);
+			gmm_estep(P, M, F, opts.covariance, R, lse);
+
+			double ll = 0;
+			for (uword i = 0 ; i < m ; i++) ll += lse[i];
+
+			const double change = ll - g.loglik;
+			g.loglik = ll;
+			if (std::abs(change) <= opts.tolerance * std::abs(ll)) {
+				g.converged = true;
+				break;
+			}
+			if (g.iterations >= opts.max_iter) break;
+		}
+
+		// the parameters of the last E-step
+		g.mu = trans(M);
+		return g;
+	}
+
+	//!	@}
+
+	//!	@addtogroup	clusteval
+	//!	@{
+
+#ifndef DOXYGEN
+	/**
+	 *	Numbers the clusters of T as g[i] = 0, ..., k - 1 in increasing order of the labels, and returns k.
+	 *	The observations labeled 0, or with NaN, are not in any cluster and get k.
+	 */
+	inline uword cluster_groups(const mat& X, const uvec& T, std::vector<uword>& g)
+	{
+		const uword m = X.n_rows, n = X.n_cols;
+		if (T.n_elem != m)
+			throw std::invalid_argument("T must have a label for each observation of X.");
+
+		g.resize(m);
+		std::vector<uword> labels;
+		for (uword i = 0 ; i < m ; i++) {
+			bool valid = T[i] > 0;
+			for (uword d = 0 ; d < n && valid ; d++) valid = !(X.at(i, d) != X.at(i, d));
+			g[i] = valid ? T[i] : 0;
+			if (valid) labels.push_back(T[i]);
+		}
+		std::sort(labels.begin(), labels.end());
+		labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+
+		const uword k = labels.size();
+		for (uword i = 0 ; i < m ; i++)
+			g[i] = (g[i] > 0) ? (uword)(std::lower_bound(labels.begin(), labels.end(), g[i]) - labels.begin()) : k;
+		return k;
+	}
+
+	/**
+	 *	Computes the centroids C (k-by-n) and the sizes of the clusters g, and the sums of the Euclidean
+	 *	distances (d1) and the squared distances (d2) of the observations to their centroids.
+	 *	The sums of the clusters are accumulated variable by variable in parallel, so that each thread
+	 *	reads a column of X and no thread needs its own copy of the sums.
+	 */
+	inline void cluster_dispersion(const mat& X, const std::vector<uword>& g, const uword k, mat& C, vec& size, vec& d1, vec& d2)
+	{
+		const uword m = X.n_rows, n = X.n_cols;
+
+		C.zeros(k, n);
+		size.zeros(k);
+		for (uword i = 0 ; i < m ; i++)
+			if (g[i] < k) size[g[i]]++;
+
+		ARMA_EXT_PARALLEL_FOR(d, n)
+			const double* x = X.colptr(d);
+			double* c = C.colptr(d);
+			for (uword i = 0 ; i < m ; i++)
+				if (g[i] < k) c[g[i]] += x[i];
+			for (uword j = 0 ; j < k ; j++) c[j] /= size[j];
+		ARMA_EXT_PARALLEL_END
+
+		vec r(m);
+		ARMA_EXT_PARALLEL_FOR(i, m)
+			double s = 0;
+			if (g[i] < k)
+				for (uword d = 0 ; d < n ; d++) {
+					const double t = X.at(i, d) - C.at(g[i], d);
+					s += t * t;
 				}
-				p1 = p1 + q + 1;
-				p2++;
-				for ( ; q>0; q--) {
-					y[p1++] = y[p2++];
+			r[i] = s;
+		ARMA_EXT_PARALLEL_END
+
+		d1.zeros(k);
+		d2.zeros(k);
+		for (uword i = 0 ; i < m ; i++)
+			if (g[i] < k) {
+				d1[g[i]] += std::sqrt(r[i]);
+				d2[g[i]] += r[i];
+			}
+	}
+
+	/**
+	 *	Sums the distances from each observation i to the observations of each cluster into S(c, i).
+	 *	Each thread takes a block row of the observations, and sweeps the blocks of the other observations
+	 *	as the tiles of #pdist, so every distance is computed twice, but the sums need no synchronization.
+	 */
+	struct silhouette_sums
+	{
+		template <typename metric_type>
+		static void apply(const mat& P, const std::vector<uword>& g, const uword k, mat& S, const metric_type& metric)
+		{
+			const uword n = P.n_rows, m = P.n_cols;
+			const uword bs = pdist_block_size(n);
+			const uword nb = (m + bs - 1) / bs;
+
+			ARMA_EXT_PARALLEL_FOR_DYNAMIC(I, nb, 1)
+				const uword i0 = I * bs, i1 = std::min(i0 + bs, m);
+				for (uword j0 = 0 ; j0 < m ; j0 += bs) {
+					const uword j1 = std::min(j0 + bs, m);
+					for (uword i = i0 ; i < i1 ; i++) {
+						if (g[i] == k) continue;
+						const double* a = P.colptr(i);
+						double* s = S.colptr(i);
+						for (uword j = j0 ; j < j1 ; j++)
+							if (j != i && g[j] < k) s[g[j]] += metric(a, P.colptr(j), n);
+					}
 				}
-			} /*if (k!=bc) */
-		} /*for (bc=0,bp=m;bc<bn;bc++,bp++) */
+			ARMA_EXT_PARALLEL_END
+		}
+	};
 
-		/* loop to fill with NaN's in case the main loop ended prematurely */
-		for (;bc<bn;bc++,bp++) {
-			k=bc; l=bc+1;
-			if (obp[k]<obp[l]) {
-				*b1++ = (TEMPL) (obp[k]+1);
-				*b2++ = (TEMPL) (obp[l]+1);
-			} else {
-				*b1++ = (TEMPL) (obp[l]+1);
-				*b2++ = (TEMPL) (obp[k]+1);
+	/**
+	 *	Moments of the pairs of distances and cophenetic distances. The pairs are summed in short runs
+	 *	relative to the first pair of each run, and the runs are merged by the pairwise update of Chan et al.,
+	 *	which avoids the cancellation of the sums of squares over many pairs.
+	 */
+	struct cophenet_moments
+	{
+		double n, my, mc, syy, scc, syc;
+
+		cophenet_moments() : n(0), my(0), mc(0), syy(0), scc(0), syc(0) {}
+
+		/// Merges a run of k pairs, whose sums are taken relative to (y0, c0).
+		void merge(const uword k, const double y0, const double c0, const double sy, const double sc,
+			const double syy_, const double scc_, const double syc_)
+		{
+			cophenet_moments o;
+			o.n = (double)k;
+			o.my = y0 + sy / o.n;
+			o.mc = c0 + sc / o.n;
+			o.syy = syy_ - sy * sy / o.n;
+			o.scc = scc_ - sc * sc / o.n;
+			o.syc = syc_ - sy * sc / o.n;
+			merge(o);
+		}
+
+		/// Merges the moments of another set of pairs.
+		void merge(const cophenet_moments& o)
+		{
+			if (o.n == 0) return;
+			const double t = n + o.n, f = n * o.n / t;
+			const double dy = o.my - my, dc = o.mc - mc;
+			syy += o.syy + dy * dy * f;
+			scc += o.scc + dc * dc * f;
+			syc += o.syc + dy * dc * f;
+			my += dy * o.n / t;
+			mc += dc * o.n / t;
+			n = t;
+		}
+	};
+
+	/**
+	 *	Orders the leaves of Z as in the dendrogram: perm[p] is the (0-based) observation at the position p,
+	 *	and merge[p] is the row of Z that joins the positions p and p + 1. Every cluster of Z then covers
+	 *	consecutive positions, and the lowest common ancestor of the positions p < q is the last row among
+	 *	merge[p], ..., merge[q - 1], since the other rows are merged into it.
+	 */
+	inline void cophenet_order(const mat& Z, std::vector<uword>& perm, std::vector<uword>& merge)
+	{
+		const uword nz = Z.n_rows, m = nz + 1;
+		std::vector<uword> size(nz), start(nz);
+		std::vector<char> used(m + nz, 0);
+
+		// each cluster is merged once, into a later row
+		for (uword r = 0 ; r < nz ; r++) {
+			size[r] = 0;
+			for (uword j = 0 ; j < 2 ; j++) {
+				const uword c = (uword)Z.at(r, j);
+				if (c < 1 || c > m + r || used[c - 1])
+					throw std::invalid_argument("Z is not a valid hierarchical cluster tree.");
+				used[c - 1] = 1;
+				size[r] += (c > m) ? size[c - m - 1] : 1;
+			}
+		}
+
+		perm.resize(m);
+		merge.resize(m);
+		if (nz == 0) {
+			perm[0] = 0;
+			return;
+		}
+
+		start[nz - 1] = 0;
+		for (uword r = nz ; r-- > 0 ; ) {
+			uword p = start[r];
+			for (uword j = 0 ; j < 2 ; j++) {
+				const uword c = (uword)Z.at(r, j);
+				if (c > m) {
+					start[c - m - 1] = p;
+					p += size[c - m - 1];
+				}
+				else
+					perm[p++] = c - 1;
+				if (j == 0) merge[p - 1] = r;
 			}
-			obp[l] = bp;
-			*s++ = arma::datum::nan;
 		}
+	}
 
-		free(y);	/* destroy the copy of pairwise distances */
+	/**
+	 *	Accumulates the moments of the distances dist(p, q) and the cophenetic distances of the positions
+	 *	p < q of the dendrogram. Each thread takes a block row of positions, and keeps the lowest common
+	 *	ancestor of each position p and the current q, which changes by a single comparison as q moves right.
+	 */
+	template <typename dist_type>
+	double cophenet_sweep(const dist_type& dist, const mat& Z, const std::vector<uword>& merge, const uword bs)
+	{
+		const uword m = Z.n_rows + 1;
+		const uword nb = (m + bs - 1) / bs;
+		std::vector<cophenet_moments> rows(nb);
 
-		if (uses_scl) free(scl);
+		ARMA_EXT_PARALLEL_FOR_DYNAMIC(I, nb, 1)
+			const uword i0 = I * bs, i1 = std::min(i0 + bs, m);
+			std::vector<uword> lca(i1 - i0, 0);
+			cophenet_moments& acc = rows[I];
 
-		free(obp);
-		free(L);
-		free(K);
-		free(T);
+			for (uword j0 = i0 ; j0 < m ; j0 += bs) {
+				const uword j1 = std::min(j0 + bs, m);
+				for (uword i = i0 ; i < i1 ; i++) {
+					const uword jb = std::max(j0, i + 1);
+					if (jb >= j1) continue;
 
-		return out;
+					uword& r = lca[i - i0];
+					r = std::max(r, merge[jb - 1]);
+					const double y0 = dist(i, jb), c0 = Z.at(r, 2);
+					double sy = 0, sc = 0, syy = 0, scc = 0, syc = 0;
+					for (uword j = jb + 1 ; j < j1 ; j++) {
+						r = std::max(r, merge[j - 1]);
+						const double y = dist(i, j) - y0, c = Z.at(r, 2) - c0;
+						sy += y;
+						sc += c;
+						syy += y * y;
+						scc += c * c;
+						syc += y * c;
+					}
+					acc.merge(j1 - jb, y0, c0, sy, sc, syy, scc, syc);
+				}
+			}
+		ARMA_EXT_PARALLEL_END
+
+		cophenet_moments t;
+		for (uword I = 0 ; I < nb ; I++) t.merge(rows[I]);
+		return t.syc / std::sqrt(t.syy * t.scc);
 	}
+
+	/// Distance between the positions of the dendrogram, from the packed observations in that order.
+	template <typename metric_type>
+	struct cophenet_packed
+	{
+		const mat& P;
+		const metric_type& metric;
+
+		cophenet_packed(const mat& P_, const metric_type& metric_) : P(P_), metric(metric_) {}
+
+		inline double operator()(const uword p, const uword q) const
+		{
+			return metric(P.colptr(p), P.colptr(q), P.n_rows);
+		}
+	};
+
+	/// Distance between the positions of the dendrogram, from the condensed distances of the observations.
+	template <typename eT>
+	struct cophenet_condensed
+	{
+		const condensed_distance<eT>& Y;
+		const std::vector<uword>& perm;
+
+		cophenet_condensed(const condensed_distance<eT>& Y_, const std::vector<uword>& perm_) : Y(Y_), perm(perm_) {}
+
+		inline double operator()(const uword p, const uword q) const
+		{
+			return (double)Y(perm[p], perm[q]);
+		}
+	};
+
+	/// Computes the cophenetic correlation c of the packed observations P in the order of the dendrogram.
+	struct cophenet_observations
+	{
+		template <typename metric_type>
+		static void apply(const mat& P, const mat& Z, const std::vector<uword>& merge, double& c, const metric_type& metric)
+		{
+			c = cophenet_sweep(cophenet_packed<metric_type>(P, metric), Z, merge, pdist_block_size(P.n_rows));
+		}
+	};
 #endif
 
 	/**
-	 *	@brief	Agglomerative hierarchical cluster tree.
-	 *	@param X The ream matrix of observation or the vector of pairwise distance of the observations.
-	 *	@return A matrix that encodes a tree of hierarchical cluster of the rows of the real matrix X or the vector of pairwise distances of matrix.<br>
-	 *			It is \f$(m - 1)\f$-by-\f$3\f$ matrix, where \f$ m \f$ is the number of observations in the original data.
-	 *	@see	http://www.mathworks.co.kr/kr/help/stats/linkage.html
-	 *	@note	This function is preliminary; it is not yet fully optimized.
-	 *			This is an simplified implementtion of linkagemex function
+	 *	@brief	Silhouette values of clustered data.<br>
+	 *			The silhouette value of the observation \f$i\f$ is \f$s_i = (b_i - a_i) / \max(a_i, b_i)\f$, where \f$a_i\f$ is
+	 *			its average distance to the other observations of its cluster, and \f$b_i\f$ the smallest average
+	 *			distance to the observations of another cluster.
+	 *	@param X		The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param T		The cluster of each observation, such as the output of #cluster or #kmeans.
+	 *	@param type		The distance metric.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	The silhouette value of each observation. The observations labeled 0, or with NaN, get NaN,
+	 *			and the observations alone in their cluster get 0. With a single cluster, every value is NaN.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/silhouette.html
+	 *	@note	The distances are computed in tiles, as by #pdist, and summed by cluster in parallel,
+	 *			so only the \f$k\f$-by-\f$m\f$ sums reside in memory.
 	 */
-	template <typename mat_type>
-	inline mat linkage(const mat_type& X)
+	inline vec silhouette(const mat& X, const uvec& T, distance_type type = squaredeuclidean, double exponent = 2)
 	{
-		return linkagemex(X);
+		const uword m = X.n_rows;
+		std::vector<uword> g;
+		const uword k = cluster_groups(X, T, g);
+
+		vec s(m);
+		s.fill(datum::nan);
+		if (k == 0) return s;
+
+		std::vector<uword> size(k + 1, 0);
+		for (uword i = 0 ; i < m ; i++) size[g[i]]++;
+
+		const pdist_metric pm(X, type, exponent);
+		const mat P = pm.pack(X);
+		mat S(k, m);
+		S.zeros();
+		pdist_dispatch<silhouette_sums>(pm, P, g, k, S);
+
+		for (uword i = 0 ; i < m ; i++) {
+			const uword c = g[i];
+			if (c == k) continue;
+			if (size[c] == 1) {
+				s[i] = 0;
+				continue;
+			}
+
+			const double a = S.at(c, i) / (size[c] - 1);
+			double b = datum::inf;
+			for (uword j = 0 ; j < k ; j++)
+				if (j != c) b = std::min(b, S.at(j, i) / size[j]);
+
+			const double t = std::max(a, b);
+			s[i] = (k == 1) ? datum::nan : (t > 0 ? (b - a) / t : 0);
+		}
+
+		return s;
 	}
 
 	/**
-	 *	@brief	Construct clusters from the agglomerative hierarchical cluster tree
-	 *	@param Z The agglomerative hierarchical cluster tree, as generated by #linkage function.
-	 *	@param c A threshold for cutting Z into clusters.
-	 *	@return	The cluster indices for each of observations.
-	 *	@see	http://www.mathworks.co.kr/kr/help/stats/cluster.html
-	 *	@note	This function is preliminary; it is not yet fully optimized.
+	 *	@brief	Davies-Bouldin index of clustered data.<br>
+	 *			The average over the clusters of \f$\max_{j \ne i} (d_i + d_j) / d_{ij}\f$, where \f$d_i\f$ is the average
+	 *			Euclidean distance of the observations of the cluster \f$i\f$ to its centroid, and \f$d_{ij}\f$ the distance
+	 *			between the centroids. Smaller values indicate better clusters.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param T	The cluster of each observation. The observations labeled 0, or with NaN, are ignored.
+	 *	@return	The index, or NaN if there are fewer than two clusters.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/clustering.evaluation.daviesbouldinevaluation-class.html
+	 */
+	inline double davies_bouldin(const mat& X, const uvec& T)
+	{
+		std::vector<uword> g;
+		const uword k = cluster_groups(X, T, g);
+		if (k < 2) return datum::nan;
+
+		mat C;
+		vec size, d1, d2;
+		cluster_dispersion(X, g, k, C, size, d1, d2);
+
+		const mat PC = trans(C);
+		double db = 0;
+		for (uword i = 0 ; i < k ; i++) {
+			double r = 0;
+			for (uword j = 0 ; j < k ; j++)
+				if (j != i) r = std::max(r, (d1[i] / size[i] + d1[j] / size[j]) / metric_euclidean()(PC.colptr(i), PC.colptr(j), PC.n_rows));
+			db += r;
+		}
+
+		return db / k;
+	}
+
+	/**
+	 *	@brief	Calinski-Harabasz index of clustered data.<br>
+	 *			The ratio of the between-cluster to the within-cluster sum of squares, \f$\frac{B / (k - 1)}{W / (m - k)}\f$.
+	 *			Larger values indicate better clusters.
+	 *	@param X	The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param T	The cluster of each observation. The observations labeled 0, or with NaN, are ignored.
+	 *	@return	The index, or NaN if there are fewer than two clusters.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/clustering.evaluation.calinskiharabaszevaluation-class.html
+	 */
+	inline double calinski_harabasz(const mat& X, const uvec& T)
+	{
+		std::vector<uword> g;
+		const uword k = cluster_groups(X, T, g);
+		if (k < 2) return datum::nan;
+
+		mat C;
+		vec size, d1, d2;
+		cluster_dispersion(X, g, k, C, size, d1, d2);
+
+		const uword n = X.n_cols;
+		double m = 0, w = 0, b = 0;
+		for (uword j = 0 ; j < k ; j++) {
+			m += size[j];
+			w += d2[j];
+		}
+		for (uword d = 0 ; d < n ; d++) {
+			double mu = 0;
+			for (uword j = 0 ; j < k ; j++) mu += size[j] * C.at(j, d);
+			mu /= m;
+			for (uword j = 0 ; j < k ; j++) b += size[j] * (C.at(j, d) - mu) * (C.at(j, d) - mu);
+		}
+
+		return (b / (k - 1)) / (w / (m - k));
+	}
+
+	/**
+	 *	@brief	Cophenetic correlation coefficient.<br>
+	 *			The linear correlation between the distances of the observations and their cophenetic distances,
+	 *			the heights of the links of Z at which they are first joined.
+	 *	@param Z	The agglomerative hierarchical cluster tree, as generated by #linkage function.
+	 *	@param Y	The distances from which Z was generated.
+	 *	@return	The cophenetic correlation coefficient.
+	 *	@see	http://www.mathworks.co.kr/kr/help/stats/cophenet.html
+	 *	@note	The observations are visited in the order of the dendrogram, where the cophenetic distances
+	 *			follow from the rows of Z that join neighboring leaves, so the cophenetic distances never reside in memory.
 	 */
-	uvec cluster(const mat& Z, double c)
+	template <typename eT>
+	inline double cophenet(const mat& Z, const condensed_distance<eT>& Y)
 	{
-		// distance cutoff criterion for forming clusters
-		vec crit = Z.col(2);	// distance criterion
-		uvec conn = checkcut(Z, c, crit);
-		return labeltree(Z, conn);
+		if (Y.n_obs() != Z.n_rows + 1)
+			throw std::invalid_argument("Y must have the distances of the observations of Z.");
+
+		std::vector<uword> perm, merge;
+		cophenet_order(Z, perm, merge);
+		return cophenet_sweep(cophenet_condensed<eT>(Y, perm), Z, merge, 256);
+	}
+
+	/**
+	 *	@brief	Cophenetic correlation coefficient.
+	 *	@param Z	The agglomerative hierarchical cluster tree, as generated by #linkage function.
+	 *	@param y	The pairwise distances from which Z was generated, as the output of #pdist.
+	 *	@see	cophenet(const mat&, const condensed_distance<eT>&)
+	 */
+	inline double cophenet(const mat& Z, const vec& y)
+	{
+		return cophenet(Z, condensed_distance<double>(y));
+	}
+
+	/**
+	 *	@brief	Cophenetic correlation coefficient of the observations.
+	 *	@param Z		The agglomerative hierarchical cluster tree of the rows of X.
+	 *	@param X		The \f$m\f$-by-\f$n\f$ data matrix.
+	 *	@param type		The distance metric.
+	 *	@param exponent	The exponent of the Minkowski distance.
+	 *	@return	The cophenetic correlation coefficient.
+	 *	@note	The distances are computed in tiles, as by #pdist, in parallel, so neither the distances nor the
+	 *			cophenetic distances reside in memory.
+	 *	@see	cophenet(const mat&, const condensed_distance<eT>&)
+	 */
+	inline double cophenet(const mat& Z, const mat& X, distance_type type, double exponent = 2)
+	{
+		const uword m = X.n_rows;
+		if (m != Z.n_rows + 1)
+			throw std::invalid_argument("Z must be the tree of the observations of X.");
+
+		std::vector<uword> perm, merge;
+		cophenet_order(Z, perm, merge);
+
+		const pdist_metric pm(X, type, exponent);
+		const mat Q = pm.pack(X);
+
+		// the packed observations in the order of the dendrogram
+		mat P(Q.n_rows, m);
+		for (uword p = 0 ; p < m ; p++)
+			std::copy(Q.colptr(perm[p]), Q.colptr(perm[p]) + Q.n_rows, P.colptr(p));
+
+		double c = 0;
+		pdist_dispatch<cophenet_observations>(pm, P, Z, merge, c);
+		return c;
 	}
 
 	//!	@}
@@ -84,6 +84,14 @@ namespace arma_ext
 			uword ma = a.n_rows, na = a.n_cols;
 			uword mb = b.n_rows, nb = b.n_cols;
 			uword mc = ma + mb - 1, nc = na + nb - 1;
+
+			// most kernels (box, Gaussian, Sobel, ...) are separable
+			Col<elem_type> hcol, hrow;
+			if (!a.is_empty() && separable(b, hcol, hrow)) {
+				apply_separable(out, a, hcol.memptr(), mb, hrow.memptr(), nb);
+				shape(out, ma, na, mb, nb, X.aux_uword);
+				return;
+			}
 			
 			out.set_size(mc, nc);
             
@@ -125,7 +133,129 @@ namespace arma_ext
             }
 #endif
 
-			switch (X.aux_uword) {
+			shape(out, ma, na, mb, nb, X.aux_uword);
+		}
+
+		/**
+		 *	@brief	The full 2-D convolution of a with the separable kernel hcol * hrow, by two 1-D passes.<br>
+		 *			Each column of the result combines the columns of a weighted by hrow, and adds the combination
+		 *			shifted and weighted by hcol. Both passes are axpy operations over contiguous columns, in
+		 *			O(ma * na * (mb + nb)) operations instead of O(ma * na * mb * nb).
+		 *	@param out	The convolution result.
+		 *	@param a	The input matrix.
+		 *	@param hcol	The kernel of the columns, of mb elements.
+		 *	@param hrow	The kernel of the rows, of nb elements.
+		 */
+		template <typename eT>
+		inline static void apply_separable(Mat<eT>& out, const Mat<eT>& a, const eT* hcol, const uword mb, const eT* hrow, const uword nb)
+		{
+			arma_extra_debug_sigprint();
+
+			uword ma = a.n_rows, na = a.n_cols;
+			uword mc = ma + mb - 1, nc = na + nb - 1;
+
+			out.zeros(mc, nc);
+
+#if defined(USE_PPL)
+			concurrency::parallel_for(uword(0), nc, [&](uword c) {
+#elif defined(USE_OPENMP)
+	#pragma omp parallel for
+			for (int sc = 0 ; sc < (int)nc ; sc++) {
+				uword c = (uword)sc;
+#else
+			for (uword c = 0 ; c < nc ; c++) {
+#endif
+				std::vector<eT> t(ma, eT(0));
+
+				// the rows, convolved with hrow
+				const uword minv = (c + 1 > nb) ? c - nb + 1 : 0;
+				const uword maxv = std::min(na - 1, c);
+				for (uword v = minv ; v <= maxv ; v++) {
+					const eT w = hrow[c - v];
+					const eT* aptr = a.colptr(v);
+					for (uword u = 0 ; u < ma ; u++)
+						t[u] += w * aptr[u];
+				}
+
+				// the columns, convolved with hcol
+				eT* outptr = out.colptr(c);
+				for (uword u = 0 ; u < mb ; u++) {
+					const eT w = hcol[u];
+					eT* dst = outptr + u;
+					for (uword r = 0 ; r < ma ; r++)
+						dst[r] += w * t[r];
+				}
+#ifdef USE_PPL
+			});
+#else
+			}
+#endif
+		}
+
+		/**
+		 *	@brief	Factors the kernel b into hcol * hrow, if it is separable.<br>
+		 *			A kernel of a single row or column is factored exactly. Otherwise b is pivoted on its element b(p,q)
+		 *			of largest magnitude, hcol = b.col(q) and hrow = b.row(p) / b(p,q), and the factors are kept
+		 *			only if hcol * hrow reproduces b within max(mb, nb) * eps * |b(p,q)|, exactly for integer kernels.
+		 *	@return	Whether b is factored.
+		 */
+		template <typename eT>
+		inline static bool separable(const Mat<eT>& b, Col<eT>& hcol, Col<eT>& hrow)
+		{
+			typedef typename get_pod_type<eT>::result pod_type;
+
+			if (b.is_empty()) return false;
+
+			const uword mb = b.n_rows, nb = b.n_cols;
+
+			if (nb == 1 || mb == 1) {
+				hcol.ones(mb);
+				hrow.ones(nb);
+				if (nb == 1)
+					hcol = Col<eT>(b.memptr(), mb);
+				else
+					hrow = Col<eT>(b.memptr(), nb);
+				return true;
+			}
+
+			// a 2-by-2 kernel takes as many operations in two passes
+			if (b.n_elem <= mb + nb) return false;
+
+			const Mat<pod_type> B = abs(b);
+			uword p = 0, q = 0;
+			for (uword j = 0 ; j < nb ; j++)
+				for (uword i = 0 ; i < mb ; i++)
+					if (B.at(i, j) > B.at(p, q)) { p = i; q = j; }
+
+			if (!(B.at(p, q) > 0)) return false;
+
+			const eT pivot = b.at(p, q);
+			hcol = b.col(q);
+			hrow.set_size(nb);
+			for (uword j = 0 ; j < nb ; j++)
+				hrow[j] = b.at(p, j) / pivot;
+
+			Mat<eT> D(mb, nb);
+			for (uword j = 0 ; j < nb ; j++)
+				for (uword i = 0 ; i < mb ; i++)
+					D.at(i, j) = hcol[i] * hrow[j] - b.at(i, j);
+
+			const pod_type tol = std::max(mb, nb) * std::numeric_limits<pod_type>::epsilon() * B.at(p, q);
+			const Mat<pod_type> E = abs(D);
+			for (uword k = 0 ; k < E.n_elem ; k++)
+				if (!(E[k] <= tol)) return false;
+
+			return true;
+		}
+
+		/**
+		 *	@brief	Extracts the part of the full convolution out of the convolution type.
+		 *	@see	convolution_type
+		 */
+		template <typename eT>
+		inline static void shape(Mat<eT>& out, const uword ma, const uword na, const uword mb, const uword nb, const uword conv_type)
+		{
+			switch (conv_type) {
 			case full:
 				// do nothing
 				break;
@@ -155,7 +285,7 @@ namespace arma_ext
 	 *	@return	convolution The result matrix.
 	 *	@see	http://www.mathworks.co.kr/kr/help/matlab/ref/conv2.html
 	 *	@see	convolution_type
-	 *	@note	This function is preliminary; it is not yet fully optimized.
+	 *	@note	A separable kernel, of a single row or column or of rank 1, is applied by two 1-D passes.
 	 */
 	template <typename T1, typename T2>
 	inline const Glue<T1, T2, glue_conv2> conv2(const Base<typename T1::elem_type, T1>& A, const Base<typename T1::elem_type, T2>& B, const uword conv_type = full)
@@ -165,5 +295,41 @@ namespace arma_ext
 		return Glue<T1, T2, glue_conv2>(A.get_ref(), B.get_ref(), conv_type);
 	}
 
+	/**
+	 *	@brief	2-D convolution of the matrix A with the separable kernel hcol * hrow.<br>
+	 *			The columns of A are convolved with hcol and the rows with hrow, as @c conv2(A, hcol * hrow),
+	 *			in O(ma * na * (mb + nb)) operations.
+	 *	@param A			The input matrix.
+	 *	@param hcol			The kernel of the columns, a vector of mb elements.
+	 *	@param hrow			The kernel of the rows, a vector of nb elements.
+	 *	@param conv_type	The convolution type
+	 *	@return	The result matrix.
+	 *	@see	http://www.mathworks.co.kr/kr/help/matlab/ref/conv2.html
+	 *	@see	convolution_type
+	 */
+	template <typename T1, typename T2, typename T3>
+	inline Mat<typename T1::elem_type> sepconv2(const Base<typename T1::elem_type, T1>& A, const Base<typename T1::elem_type, T2>& hcol,
+		const Base<typename T1::elem_type, T3>& hrow, const uword conv_type = full)
+	{
+		arma_extra_debug_sigprint();
+
+		typedef typename T1::elem_type elem_type;
+
+		const Mat<elem_type>& a = A.get_ref();
+		const Mat<elem_type>& u = hcol.get_ref();
+		const Mat<elem_type>& v = hrow.get_ref();
+
+		if (!u.is_vec() || !v.is_vec())
+			throw std::invalid_argument("hcol and hrow must be vectors.");
+		if (a.is_empty() || u.is_empty() || v.is_empty())
+			throw std::invalid_argument("A, hcol and hrow must not be empty.");
+
+		Mat<elem_type> out;
+		glue_conv2::apply_separable(out, a, u.memptr(), u.n_elem, v.memptr(), v.n_elem);
+		glue_conv2::shape(out, a.n_rows, a.n_cols, u.n_elem, v.n_elem, conv_type);
+
+		return out;
+	}
+
 	//!	@}
 }